@@ -2,176 +2,4148 @@
 #include <map>
 #include <vector>
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <chrono>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <unordered_map>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <random>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-enum class UserClass
+// Ownership and permission bits of a node packed into one word:
+//   bits 0-8    rwx for other, group and owner (the usual octal mode)
+//   bits 16-39  owning group
+//   bits 40-63  owning user
+using Attributes = std::uint64_t;
+
+const unsigned mode_read = 4;
+const unsigned mode_write = 2;
+const unsigned mode_execute = 1;
+const unsigned default_directory_mode = 0777;
+const unsigned default_file_mode = 0666;
+const std::uint32_t max_id = (1u << 24) - 1;
+
+// Function to pack a mode and owner into an attribute word
+Attributes make_attributes(unsigned mode, std::uint32_t uid, std::uint32_t gid)
+{
+    return (Attributes(uid) << 40) | (Attributes(gid) << 16) | (mode & 0777);
+}
+
+unsigned attributes_mode(Attributes attributes)
+{
+    return attributes & 0777;
+}
+
+std::uint32_t attributes_uid(Attributes attributes)
+{
+    return static_cast<std::uint32_t>(attributes >> 40);
+}
+
+std::uint32_t attributes_gid(Attributes attributes)
+{
+    return static_cast<std::uint32_t>(attributes >> 16) & max_id;
+}
+
+// Handle to an inode; file data and size live in the inode table
+using InodeId = std::size_t;
+
+const std::size_t block_size = 4096;    // unit of the block store
+const std::size_t inline_capacity = 60; // files this small stay inside the inode
+
+// A run of contiguous blocks in the block store
+struct Extent
+{
+    std::size_t start; // first block
+    std::size_t count; // number of blocks
+};
+
+// Define a structure for Inode
+struct Inode
+{
+    std::size_t size;
+    std::vector<Extent> extents; // empty while the data is inline
+    char inline_data[inline_capacity];
+};
+
+// Define a structure for File; its name is the key of its directory entry
+struct File
+{
+    Attributes attributes;
+    InodeId inode;
+};
+
+// Handle to a directory node; nodes are owned once by the directory table
+using DirectoryId = std::size_t;
+const DirectoryId no_directory = static_cast<DirectoryId>(-1);
+const std::uint32_t no_image_node = static_cast<std::uint32_t>(-1);
+
+// What a name inside a directory refers to
+enum class EntryKind : std::uint8_t
+{
+    none, // negative entry: the name does not exist
+    directory,
+    file
+};
+
+// Growable table whose elements never move, so handles stay valid while other
+// threads add nodes. Elements are allocated in fixed-size chunks and freed
+// slots are recycled.
+template <typename T>
+class NodeTable
+{
+public:
+    ~NodeTable()
+    {
+        clear();
+    }
+
+    T &operator[](std::size_t id)
+    {
+        return chunks[id >> chunk_bits].load(std::memory_order_acquire)[id & (chunk_size - 1)];
+    }
+
+    std::size_t allocate()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!free_ids.empty())
+        {
+            std::size_t id = free_ids.back();
+            free_ids.pop_back();
+            return id;
+        }
+        std::size_t id = count++;
+        if ((id & (chunk_size - 1)) == 0)
+        {
+            chunks[id >> chunk_bits].store(new T[chunk_size], std::memory_order_release);
+        }
+        return id;
+    }
+
+    // Number of slots handed out so far, free or in use
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    void release(std::size_t id)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        free_ids.push_back(id);
+    }
+
+    // Not thread-safe: only for replacing the whole tree
+    void clear()
+    {
+        for (std::size_t chunk = 0; chunk * chunk_size < count; chunk++)
+        {
+            delete[] chunks[chunk].exchange(nullptr);
+        }
+        count = 0;
+        free_ids.clear();
+    }
+
+private:
+    static const std::size_t chunk_bits = 12;
+    static const std::size_t chunk_size = std::size_t(1) << chunk_bits;
+    static const std::size_t max_chunks = std::size_t(1) << 16;
+
+    std::atomic<T *> chunks[max_chunks] = {};
+    std::size_t count = 0;
+    std::vector<std::size_t> free_ids;
+    std::mutex mutex;
+};
+
+// Handle to a name in the name pool
+using NameId = std::uint32_t;
+const NameId no_name = static_cast<NameId>(-1);
+
+// Pool of interned names. Each distinct name is stored once, as a reference
+// count, its length and its bytes in a chunked arena, and everything else
+// refers to it by a 4-byte id: a directory and its entry in the parent share
+// one copy, and the same file name in a thousand directories is stored once.
+// Interning locks one of shard_count shards chosen by hash, so sessions
+// creating names rarely contend; reading a name by id takes no lock. When
+// the last reference to a name goes, it leaves the table and its id and
+// bytes are reused by later names.
+class NamePool
+{
+public:
+    // Returns the id of name, taking a reference to it
+    NameId intern(std::string_view name)
+    {
+        std::size_t hash = std::hash<std::string_view>()(name);
+        Shard &shard = shards[hash & (shard_count - 1)];
+        std::uint32_t tag = static_cast<std::uint32_t>(hash >> shard_bits);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        if (2 * (shard.used + 1) > shard.slots.size())
+        {
+            grow(shard);
+        }
+        std::size_t mask = shard.slots.size() - 1;
+        for (std::size_t slot = tag & mask;; slot = (slot + 1) & mask)
+        {
+            Slot &entry = shard.slots[slot];
+            if (entry.id == no_name)
+            {
+                entry = {store(shard, name), tag};
+                shard.used++;
+                return entry.id;
+            }
+            if (entry.tag == tag && view(entry.id) == name)
+            {
+                references(entry.id).fetch_add(1, std::memory_order_relaxed);
+                return entry.id;
+            }
+        }
+    }
+
+    // Takes another reference to a name its caller already holds one to
+    void retain(NameId id)
+    {
+        if (id != no_name)
+        {
+            references(id).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Drops a reference, removing the name when it was the last one. Only
+    // the last reference is dropped under the shard lock: until then the
+    // caller's reference keeps the id and bytes from being reused, and once
+    // the lock is held intern cannot revive the name behind its back.
+    void release(NameId id)
+    {
+        if (id == no_name)
+        {
+            return;
+        }
+        std::atomic<std::uint32_t> &count = references(id);
+        std::uint32_t seen = count.load(std::memory_order_relaxed);
+        while (seen > 1)
+        {
+            if (count.compare_exchange_weak(seen, seen - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+        std::string_view name = view(id);
+        std::size_t hash = std::hash<std::string_view>()(name);
+        Shard &shard = shards[hash & (shard_count - 1)];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        // intern may have taken a reference before the lock was held
+        if (count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            return;
+        }
+        std::size_t mask = shard.slots.size() - 1;
+        std::size_t slot = static_cast<std::uint32_t>(hash >> shard_bits) & mask;
+        while (shard.slots[slot].id != id)
+        {
+            if (shard.slots[slot].id == no_name)
+            {
+                return;
+            }
+            slot = (slot + 1) & mask;
+        }
+        // Shift back later entries of the run that would no longer be found
+        std::size_t hole = slot;
+        for (std::size_t next = (hole + 1) & mask; shard.slots[next].id != no_name; next = (next + 1) & mask)
+        {
+            std::size_t home = shard.slots[next].tag & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                shard.slots[hole] = shard.slots[next];
+                hole = next;
+            }
+        }
+        shard.slots[hole] = Slot();
+        shard.used--;
+
+        char *text = texts[id] - sizeof(std::uint32_t);
+        std::size_t size = record_size(name.size());
+        shard.free_records[size].push_back(text);
+        texts.release(id);
+    }
+
+    std::string_view view(NameId id)
+    {
+        if (id == no_name)
+        {
+            return {};
+        }
+        const char *text = texts[id];
+        std::uint32_t length;
+        std::memcpy(&length, text, sizeof(length));
+        return {text + sizeof(length), length};
+    }
+
+    // Number of distinct names and the bytes holding them, tables included
+    void usage(std::size_t &count, std::size_t &bytes)
+    {
+        count = 0;
+        bytes = texts.size() * sizeof(const char *);
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            count += shard.used;
+            bytes += shard.arena_bytes + shard.slots.size() * sizeof(Slot);
+        }
+    }
+
+    // Not thread-safe: only for replacing the whole tree
+    void clear()
+    {
+        for (Shard &shard : shards)
+        {
+            shard.slots.clear();
+            shard.blocks.clear();
+            shard.free_records.clear();
+            shard.used = shard.free = shard.arena_bytes = 0;
+            shard.cursor = nullptr;
+        }
+        texts.clear();
+    }
+
+private:
+    static const std::size_t shard_bits = 4;
+    static const std::size_t shard_count = std::size_t(1) << shard_bits;
+    static const std::size_t block_bytes = 64 * 1024;
+
+    struct Slot
+    {
+        NameId id = no_name;
+        std::uint32_t tag = 0; // hash bits, so most probes skip the name
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Slot> slots; // open addressing, at most half full
+        std::size_t used = 0;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char *cursor = nullptr;
+        std::size_t free = 0;
+        std::size_t arena_bytes = 0;
+        std::unordered_map<std::size_t, std::vector<char *>> free_records; // by record size
+    };
+
+    // Bytes of a name's record: count, length and text, rounded up so the
+    // next record's count stays aligned
+    static std::size_t record_size(std::size_t length)
+    {
+        return (2 * sizeof(std::uint32_t) + length + alignof(std::uint32_t) - 1) / alignof(std::uint32_t) * alignof(std::uint32_t);
+    }
+
+    // The reference count stored just before a name's length
+    std::atomic<std::uint32_t> &references(NameId id)
+    {
+        return *reinterpret_cast<std::atomic<std::uint32_t> *>(texts[id] - sizeof(std::uint32_t));
+    }
+
+    // Copies a name into the shard's arena, reusing the record of a
+    // removed name of the same size if there is one, and gives it an id
+    // with one reference
+    NameId store(Shard &shard, std::string_view name)
+    {
+        std::uint32_t length = static_cast<std::uint32_t>(name.size());
+        std::size_t need = record_size(length);
+        char *record;
+        auto reusable = shard.free_records.find(need);
+        if (reusable != shard.free_records.end() && !reusable->second.empty())
+        {
+            record = reusable->second.back();
+            reusable->second.pop_back();
+        }
+        else
+        {
+            if (need > shard.free)
+            {
+                std::size_t size = need > block_bytes ? need : block_bytes;
+                shard.blocks.emplace_back(new char[size]);
+                shard.cursor = shard.blocks.back().get();
+                shard.free = size;
+                shard.arena_bytes += size;
+            }
+            record = shard.cursor;
+            shard.cursor += need;
+            shard.free -= need;
+        }
+        new (record) std::atomic<std::uint32_t>(1);
+        char *text = record + sizeof(std::uint32_t);
+        std::memcpy(text, &length, sizeof(length));
+        std::memcpy(text + sizeof(length), name.data(), length);
+
+        NameId id = static_cast<NameId>(texts.allocate());
+        texts[id] = text;
+        return id;
+    }
+
+    static void grow(Shard &shard)
+    {
+        std::vector<Slot> slots(std::max<std::size_t>(64, 2 * shard.slots.size()));
+        std::size_t mask = slots.size() - 1;
+        for (const Slot &entry : shard.slots)
+        {
+            if (entry.id != no_name)
+            {
+                std::size_t slot = entry.tag & mask;
+                while (slots[slot].id != no_name)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                slots[slot] = entry;
+            }
+        }
+        shard.slots.swap(slots);
+    }
+
+    Shard shards[shard_count];
+    NodeTable<char *> texts; // id -> length and bytes
+};
+
+NamePool names;
+
+// A directory or entry name: a counted reference to its interned text, so
+// a name is freed when no entry, directory or fence uses it
+class EntryName
+{
+public:
+    EntryName() = default;
+
+    explicit EntryName(std::string_view name) : id(names.intern(name)) {}
+
+    EntryName(const EntryName &other) : id(other.id)
+    {
+        names.retain(id);
+    }
+
+    EntryName(EntryName &&other) noexcept : id(other.id)
+    {
+        other.id = no_name;
+    }
+
+    EntryName &operator=(EntryName other) noexcept
+    {
+        std::swap(id, other.id);
+        return *this;
+    }
+
+    ~EntryName()
+    {
+        names.release(id);
+    }
+
+    std::string_view view() const
+    {
+        return names.view(id);
+    }
+
+private:
+    NameId id = no_name;
+};
+
+// One name in a directory: a subdirectory handle or a file. Two fit in a
+// cache line.
+struct DirectoryEntry
+{
+    EntryName name;
+    EntryKind kind;
+    DirectoryId directory; // kind == directory
+    File file;             // kind == file
+};
+
+// Function to build the entry for a subdirectory
+DirectoryEntry directory_entry(EntryName name, DirectoryId id)
+{
+    return {name, EntryKind::directory, id, {0, 0}};
+}
+
+// Function to build the entry for a file
+DirectoryEntry file_entry(EntryName name, File file)
+{
+    return {name, EntryKind::file, no_directory, file};
+}
+
+// The entries of one directory, files and subdirectories together, sorted by
+// name. It is a two-level B-tree: entries live in sorted leaf arrays of up to
+// leaf_capacity, and a flat array of fence keys (the first name in each leaf)
+// routes a search to its leaf. Lookups are two binary searches over
+// contiguous arrays of name ids, inserts and erases move at most one leaf, and
+// names arriving in order (as from an image) fill leaves completely.
+class DirectoryIndex
+{
+public:
+    class iterator
+    {
+    public:
+        const DirectoryEntry &operator*() const
+        {
+            return (*leaves)[leaf][position];
+        }
+
+        const DirectoryEntry *operator->() const
+        {
+            return &**this;
+        }
+
+        iterator &operator++()
+        {
+            if (++position == (*leaves)[leaf].size())
+            {
+                leaf++;
+                position = 0;
+            }
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const
+        {
+            return leaf == other.leaf && position == other.position;
+        }
+
+        bool operator!=(const iterator &other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class DirectoryIndex;
+
+        iterator(const std::vector<std::vector<DirectoryEntry>> *leaves, std::size_t leaf, std::size_t position)
+            : leaves(leaves), leaf(leaf), position(position) {}
+
+        const std::vector<std::vector<DirectoryEntry>> *leaves;
+        std::size_t leaf, position;
+    };
+
+    iterator begin() const
+    {
+        return {&leaves, 0, 0};
+    }
+
+    iterator end() const
+    {
+        return {&leaves, leaves.size(), 0};
+    }
+
+    // First entry whose name is not less than name
+    iterator lower_bound(std::string_view name) const
+    {
+        if (leaves.empty())
+        {
+            return end();
+        }
+        std::size_t leaf = leaf_for(name);
+        std::size_t position = position_in(leaves[leaf], name);
+        if (position == leaves[leaf].size())
+        {
+            return {&leaves, leaf + 1, 0};
+        }
+        return {&leaves, leaf, position};
+    }
+
+    DirectoryEntry *find(std::string_view name)
+    {
+        if (leaves.empty())
+        {
+            return nullptr;
+        }
+        std::vector<DirectoryEntry> &leaf = leaves[leaf_for(name)];
+        std::size_t position = position_in(leaf, name);
+        return position < leaf.size() && leaf[position].name.view() == name ? &leaf[position] : nullptr;
+    }
+
+    // Adds an entry unless its name is taken; returns whether it was added
+    bool insert(DirectoryEntry entry)
+    {
+        std::string_view name = entry.name.view();
+        if (leaves.empty())
+        {
+            leaves.emplace_back();
+            fences.push_back(entry.name);
+        }
+        std::size_t leaf_id = leaf_for(name);
+        std::vector<DirectoryEntry> &leaf = leaves[leaf_id];
+        std::size_t position = position_in(leaf, name);
+        if (position < leaf.size() && leaf[position].name.view() == name)
+        {
+            return false;
+        }
+        (entry.kind == EntryKind::directory ? directory_total : file_total)++;
+
+        if (leaf.size() == leaf_capacity && position == leaf.size() && leaf_id + 1 == leaves.size())
+        {
+            // Appending past the last name: start a new leaf instead of
+            // splitting, so sorted input packs leaves full
+            fences.push_back(entry.name);
+            leaves.emplace_back();
+            leaves.back().reserve(leaf_capacity);
+            leaves.back().push_back(std::move(entry));
+            return true;
+        }
+
+        leaf.insert(leaf.begin() + position, std::move(entry));
+        if (position == 0)
+        {
+            fences[leaf_id] = leaf.front().name;
+        }
+        if (leaf.size() > leaf_capacity)
+        {
+            std::size_t half = leaf.size() / 2;
+            std::vector<DirectoryEntry> upper;
+            upper.reserve(leaf_capacity);
+            std::move(leaf.begin() + half, leaf.end(), std::back_inserter(upper));
+            leaf.erase(leaf.begin() + half, leaf.end());
+            fences.insert(fences.begin() + leaf_id + 1, upper.front().name);
+            leaves.insert(leaves.begin() + leaf_id + 1, std::move(upper));
+        }
+        return true;
+    }
+
+    // Removes the entry with this name; returns whether there was one
+    bool erase(std::string_view name)
+    {
+        if (leaves.empty())
+        {
+            return false;
+        }
+        std::size_t leaf_id = leaf_for(name);
+        std::vector<DirectoryEntry> &leaf = leaves[leaf_id];
+        std::size_t position = position_in(leaf, name);
+        if (position == leaf.size() || leaf[position].name.view() != name)
+        {
+            return false;
+        }
+        (leaf[position].kind == EntryKind::directory ? directory_total : file_total)--;
+        leaf.erase(leaf.begin() + position);
+        if (leaf.empty())
+        {
+            leaves.erase(leaves.begin() + leaf_id);
+            fences.erase(fences.begin() + leaf_id);
+        }
+        else if (position == 0)
+        {
+            fences[leaf_id] = leaf.front().name;
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        leaves.clear();
+        fences.clear();
+        directory_total = file_total = 0;
+    }
+
+    bool empty() const
+    {
+        return leaves.empty();
+    }
+
+    std::size_t directory_count() const
+    {
+        return directory_total;
+    }
+
+    std::size_t file_count() const
+    {
+        return file_total;
+    }
+
+    // Heap bytes held by the leaves and fences
+    std::size_t memory() const
+    {
+        std::size_t bytes = leaves.capacity() * sizeof(leaves[0]) + fences.capacity() * sizeof(EntryName);
+        for (const std::vector<DirectoryEntry> &leaf : leaves)
+        {
+            bytes += leaf.capacity() * sizeof(DirectoryEntry);
+        }
+        return bytes;
+    }
+
+private:
+    static const std::size_t leaf_capacity = 256;
+
+    // Leaf whose range holds name: the last one whose fence is not greater
+    std::size_t leaf_for(std::string_view name) const
+    {
+        auto it = std::upper_bound(fences.begin(), fences.end(), name, [](std::string_view key, const EntryName &fence)
+                                   { return key < fence.view(); });
+        return it == fences.begin() ? 0 : it - fences.begin() - 1;
+    }
+
+    static std::size_t position_in(const std::vector<DirectoryEntry> &leaf, std::string_view name)
+    {
+        auto it = std::lower_bound(leaf.begin(), leaf.end(), name, [](const DirectoryEntry &entry, std::string_view key)
+                                   { return entry.name.view() < key; });
+        return it - leaf.begin();
+    }
+
+    std::vector<std::vector<DirectoryEntry>> leaves;
+    std::vector<EntryName> fences;
+    std::size_t directory_total = 0, file_total = 0;
+};
+
+// Define a structure for Directory. lock guards the entry index and the
+// inodes of the files in this directory; name and parent never change while
+// the node is in use. generation is bumped when the node is freed, so a
+// DirectoryRef taken earlier can tell that it has gone stale.
+struct Directory
+{
+    EntryName name;
+    std::uint32_t parent_generation;
+    std::atomic<std::uint32_t> generation{0};
+    std::atomic<std::uint32_t> image_node{no_image_node}; // children still to be read from the image
+    DirectoryId parent;                                   // no_directory for root
+    std::atomic<Attributes> attributes{0};               // read without the lock on lookups
+    DirectoryIndex entries;                               // child handles and files, by name
+    std::shared_mutex lock;
+};
+
+// A directory handle together with the generation it had when the reference
+// was taken
+struct DirectoryRef
+{
+    DirectoryId id;
+    std::uint32_t generation;
+};
+
+// Directory and inode tables
+NodeTable<Directory> directories;
+NodeTable<Inode> inodes;
+
+// Declare a global handle for the root directory
+DirectoryId root;
+
+// Block store: blocks [0, image_blocks) live in the mapped image (copy-on-write),
+// later blocks live in block_store on the heap. Free space is tracked as
+// extents indexed both by start (for coalescing) and by length (for best-fit
+// allocation); no extent ever straddles the two regions.
+//
+// extent_lock guards the free-extent indexes. store_lock is held shared while
+// touching block bytes and exclusively while the heap region grows.
+char *image_block_base = nullptr;
+std::size_t image_blocks = 0;
+std::vector<char> block_store;
+std::map<std::size_t, std::size_t> free_extents_by_start;
+std::multimap<std::size_t, std::size_t> free_extents_by_length;
+std::mutex extent_lock;
+std::shared_mutex store_lock;
+
+// Function to return a pointer to the first byte of a block
+char *block_data(std::size_t block)
+{
+    if (block < image_blocks)
+    {
+        return image_block_base + block * block_size;
+    }
+    return block_store.data() + (block - image_blocks) * block_size;
+}
+
+// Function to return the number of blocks in both regions of the store
+std::size_t total_blocks()
+{
+    return image_blocks + block_store.size() / block_size;
+}
+
+// Function to grow the heap region of the store by count blocks
+void grow_store(std::size_t count)
+{
+    std::unique_lock<std::shared_mutex> guard(store_lock);
+    block_store.resize(block_store.size() + count * block_size);
+}
+
+// Function to remove a free extent from both indexes
+void unlink_free_extent(std::map<std::size_t, std::size_t>::iterator it)
+{
+    auto range = free_extents_by_length.equal_range(it->second);
+    for (auto len_it = range.first; len_it != range.second; ++len_it)
+    {
+        if (len_it->second == it->first)
+        {
+            free_extents_by_length.erase(len_it);
+            break;
+        }
+    }
+    free_extents_by_start.erase(it);
+}
+
+// Function to give blocks back to the store, merging with free neighbours.
+// The caller holds extent_lock.
+void release_extent_locked(std::size_t start, std::size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    auto next = free_extents_by_start.lower_bound(start);
+    if (next != free_extents_by_start.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == start && start != image_blocks)
+        {
+            start = prev->first;
+            count += prev->second;
+            unlink_free_extent(prev);
+        }
+    }
+    if (next != free_extents_by_start.end() && start + count == next->first && next->first != image_blocks)
+    {
+        count += next->second;
+        unlink_free_extent(next);
+    }
+
+    free_extents_by_start[start] = count;
+    free_extents_by_length.insert({count, start});
+}
+
+// Function to give blocks back to the store
+void release_extent(std::size_t start, std::size_t count)
+{
+    std::lock_guard<std::mutex> guard(extent_lock);
+    release_extent_locked(start, count);
+}
+
+// Function to hand out count contiguous blocks (best fit, else grow the store)
+std::size_t allocate_extent(std::size_t count)
+{
+    std::lock_guard<std::mutex> guard(extent_lock);
+    auto fit = free_extents_by_length.lower_bound(count);
+    if (fit != free_extents_by_length.end())
+    {
+        std::size_t start = fit->second;
+        std::size_t length = fit->first;
+        unlink_free_extent(free_extents_by_start.find(start));
+        release_extent_locked(start + count, length - count);
+        return start;
+    }
+
+    std::size_t start = total_blocks();
+    grow_store(count);
+    return start;
+}
+
+// Function to grow an extent in place when the blocks right after it are free
+bool extend_extent(Extent &extent, std::size_t extra)
+{
+    std::lock_guard<std::mutex> guard(extent_lock);
+    std::size_t end = extent.start + extent.count;
+    if (end == total_blocks() && end > image_blocks)
+    {
+        grow_store(extra);
+        extent.count += extra;
+        return true;
+    }
+
+    auto next = free_extents_by_start.find(end);
+    if (next == free_extents_by_start.end() || next->second < extra)
+    {
+        return false;
+    }
+    std::size_t length = next->second;
+    unlink_free_extent(next);
+    release_extent_locked(end + extra, length - extra);
+    extent.count += extra;
+    return true;
+}
+
+// Function to allocate an empty inode and return its handle
+InodeId new_inode()
+{
+    InodeId id = inodes.allocate();
+    inodes[id].size = 0;
+    inodes[id].extents.clear();
+    return id;
+}
+
+// Function to release an inode together with its blocks
+void free_inode(InodeId id)
+{
+    for (const Extent &extent : inodes[id].extents)
+    {
+        release_extent(extent.start, extent.count);
+    }
+    inodes[id].extents.clear();
+    inodes[id].size = 0;
+    inodes.release(id);
+}
+
+// Function to count the blocks an inode holds
+std::size_t inode_blocks(const Inode &inode)
+{
+    std::size_t blocks = 0;
+    for (const Extent &extent : inode.extents)
+    {
+        blocks += extent.count;
+    }
+    return blocks;
+}
+
+// Function to change the size of an inode, moving between inline and block
+// storage as needed. Bytes past the old size are left unspecified.
+void inode_resize(Inode &inode, std::size_t new_size)
+{
+    bool was_inline = inode.extents.empty();
+    std::size_t have = inode_blocks(inode);
+    std::size_t need = new_size <= inline_capacity ? 0 : (new_size + block_size - 1) / block_size;
+
+    if (need > have)
+    {
+        std::size_t extra = need - have;
+        if (inode.extents.empty() || !extend_extent(inode.extents.back(), extra))
+        {
+            inode.extents.push_back({allocate_extent(extra), extra});
+        }
+        if (was_inline)
+        {
+            std::shared_lock<std::shared_mutex> guard(store_lock);
+            std::memcpy(block_data(inode.extents.front().start), inode.inline_data, inode.size);
+        }
+    }
+    else if (need < have)
+    {
+        if (need == 0)
+        {
+            // Shrinking back to inline: keep the leading bytes
+            std::shared_lock<std::shared_mutex> guard(store_lock);
+            std::memcpy(inode.inline_data, block_data(inode.extents.front().start), new_size);
+        }
+        std::size_t drop = have - need;
+        while (drop > 0)
+        {
+            Extent &last = inode.extents.back();
+            std::size_t n = std::min(drop, last.count);
+            release_extent(last.start + last.count - n, n);
+            last.count -= n;
+            drop -= n;
+            if (last.count == 0)
+            {
+                inode.extents.pop_back();
+            }
+        }
+    }
+    inode.size = new_size;
+}
+
+// Function to hand the byte range [offset, offset + length) of an inode to
+// emit as contiguous spans, one per extent, without copying
+template <typename Emit>
+void inode_spans(Inode &inode, std::size_t offset, std::size_t length, Emit emit)
+{
+    if (inode.extents.empty())
+    {
+        emit(inode.inline_data + offset, length);
+        return;
+    }
+
+    std::shared_lock<std::shared_mutex> guard(store_lock);
+    std::size_t extent_offset = 0;
+    for (const Extent &extent : inode.extents)
+    {
+        std::size_t extent_bytes = extent.count * block_size;
+        if (length > 0 && offset < extent_offset + extent_bytes)
+        {
+            std::size_t begin = offset - extent_offset;
+            std::size_t n = std::min(length, extent_bytes - begin);
+            emit(block_data(extent.start) + begin, n);
+            offset += n;
+            length -= n;
+        }
+        extent_offset += extent_bytes;
+    }
+}
+
+// Function to write data into an inode at offset, growing it if needed
+void inode_write(Inode &inode, std::size_t offset, std::string_view data)
+{
+    if (offset + data.size() > inode.size)
+    {
+        inode_resize(inode, offset + data.size());
+    }
+    const char *src = data.data();
+    inode_spans(inode, offset, data.size(), [&](char *dst, std::size_t n)
+                { std::memcpy(dst, src, n); src += n; });
+}
+
+// Function to copy an inode's content into dst, a fresh inode no other thread
+// can see. Both block lists are walked under one hold of store_lock, since
+// taking it again for dst while src holds it could deadlock behind grow_store.
+void inode_copy(Inode &src, Inode &dst)
+{
+    inode_resize(dst, src.size);
+    if (dst.extents.empty())
+    {
+        std::memcpy(dst.inline_data, src.inline_data, src.size);
+        return;
+    }
+
+    std::shared_lock<std::shared_mutex> guard(store_lock);
+    std::size_t src_extent = 0, src_offset = 0, dst_extent = 0, dst_offset = 0;
+    for (std::size_t left = src.size; left > 0;)
+    {
+        const Extent &from = src.extents[src_extent];
+        const Extent &to = dst.extents[dst_extent];
+        std::size_t n = std::min({left, from.count * block_size - src_offset, to.count * block_size - dst_offset});
+        std::memcpy(block_data(to.start) + dst_offset, block_data(from.start) + src_offset, n);
+        left -= n;
+        src_offset += n;
+        dst_offset += n;
+        if (src_offset == from.count * block_size)
+        {
+            src_extent++;
+            src_offset = 0;
+        }
+        if (dst_offset == to.count * block_size)
+        {
+            dst_extent++;
+            dst_offset = 0;
+        }
+    }
+}
+
+// Dentry cache: a direct-mapped hash table of (parent, name) -> entry. The
+// parent's generation is part of the key, so entries that point into a
+// removed subtree go stale on their own.
+//
+// Each slot is a seqlock: readers never write shared memory, writers
+// serialize on a striped mutex and make the sequence odd while they update.
+// Names longer than dentry_name_max bytes are simply not cached.
+const std::size_t dentry_name_words = 3;
+const std::size_t dentry_name_max = dentry_name_words * sizeof(std::uint64_t);
+
+struct Dentry
+{
+    std::atomic<std::uint32_t> sequence{0};
+    std::atomic<std::uint64_t> parent{no_directory};
+    std::atomic<std::uint32_t> parent_generation{0};
+    std::atomic<std::uint32_t> name_length{0};
+    std::atomic<std::uint64_t> name[dentry_name_words] = {};
+    std::atomic<std::uint32_t> kind{0};
+    std::atomic<std::uint64_t> target{no_directory};
+    std::atomic<std::uint32_t> target_generation{0};
+    std::atomic<Attributes> target_attributes{0};
+};
+
+// A name packed into words for comparison against cache slots
+struct DentryName
+{
+    std::uint64_t words[dentry_name_words] = {};
+    std::uint32_t length;
+    bool cacheable;
+
+    explicit DentryName(std::string_view name) : length(static_cast<std::uint32_t>(name.size())), cacheable(name.size() <= dentry_name_max)
+    {
+        if (cacheable)
+        {
+            std::memcpy(words, name.data(), name.size());
+        }
+    }
+};
+
+const std::size_t dentry_cache_size = 1 << 16; // must be a power of two
+const std::size_t dentry_lock_stripes = 256;
+Dentry dentry_cache[dentry_cache_size];
+std::mutex dentry_locks[dentry_lock_stripes];
+
+// Function to pick the dentry cache slot for a (parent, name) pair
+std::size_t dentry_slot(DirectoryId parent, std::string_view name)
+{
+    std::uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (char c : name)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    hash ^= (parent + 0x9e3779b97f4a7c15ull) + (hash << 6) + (hash >> 2);
+    return hash & (dentry_cache_size - 1);
+}
+
+// Function to read a slot if it holds (parent, name); false on a miss or
+// when a writer got in the way
+bool dentry_get(std::size_t slot, DirectoryRef parent, const DentryName &name, EntryKind &kind, DirectoryRef &target, Attributes &attributes)
+{
+    const Dentry &dentry = dentry_cache[slot];
+    std::uint32_t before = dentry.sequence.load(std::memory_order_acquire);
+    if (before & 1)
+    {
+        return false;
+    }
+
+    bool match = dentry.parent.load(std::memory_order_relaxed) == parent.id &&
+                 dentry.parent_generation.load(std::memory_order_relaxed) == parent.generation &&
+                 dentry.name_length.load(std::memory_order_relaxed) == name.length;
+    for (std::size_t i = 0; match && i < dentry_name_words; i++)
+    {
+        match = dentry.name[i].load(std::memory_order_relaxed) == name.words[i];
+    }
+    kind = static_cast<EntryKind>(dentry.kind.load(std::memory_order_relaxed));
+    target = {dentry.target.load(std::memory_order_relaxed), dentry.target_generation.load(std::memory_order_relaxed)};
+    attributes = dentry.target_attributes.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return match && dentry.sequence.load(std::memory_order_relaxed) == before;
+}
+
+// Function to fill a slot. Called with the parent directory locked, so it
+// cannot race with an invalidation of the same name.
+void dentry_put(std::size_t slot, DirectoryRef parent, const DentryName &name, EntryKind kind, DirectoryRef target, Attributes attributes)
+{
+    Dentry &dentry = dentry_cache[slot];
+    std::lock_guard<std::mutex> guard(dentry_locks[slot & (dentry_lock_stripes - 1)]);
+    std::uint32_t sequence = dentry.sequence.load(std::memory_order_relaxed);
+    dentry.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    dentry.parent.store(parent.id, std::memory_order_relaxed);
+    dentry.parent_generation.store(parent.generation, std::memory_order_relaxed);
+    dentry.name_length.store(name.length, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < dentry_name_words; i++)
+    {
+        dentry.name[i].store(name.words[i], std::memory_order_relaxed);
+    }
+    dentry.kind.store(static_cast<std::uint32_t>(kind), std::memory_order_relaxed);
+    dentry.target.store(target.id, std::memory_order_relaxed);
+    dentry.target_generation.store(target.generation, std::memory_order_relaxed);
+    dentry.target_attributes.store(attributes, std::memory_order_relaxed);
+
+    dentry.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Function to empty one slot
+void dentry_clear_slot(std::size_t slot)
+{
+    Dentry &dentry = dentry_cache[slot];
+    std::uint32_t sequence = dentry.sequence.load(std::memory_order_relaxed);
+    dentry.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    dentry.parent.store(no_directory, std::memory_order_relaxed);
+    dentry.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Function to drop the cached entry for a name whose meaning has changed.
+// Called with the parent directory locked exclusively.
+void dentry_invalidate(DirectoryId parent, std::string_view name)
+{
+    std::size_t slot = dentry_slot(parent, name);
+    std::lock_guard<std::mutex> guard(dentry_locks[slot & (dentry_lock_stripes - 1)]);
+    if (dentry_cache[slot].parent.load(std::memory_order_relaxed) == parent)
+    {
+        dentry_clear_slot(slot);
+    }
+}
+
+// Function to empty the whole dentry cache
+void dentry_clear()
+{
+    for (std::size_t slot = 0; slot < dentry_cache_size; slot++)
+    {
+        std::lock_guard<std::mutex> guard(dentry_locks[slot & (dentry_lock_stripes - 1)]);
+        dentry_clear_slot(slot);
+    }
+}
+
+// Function to take a reference to a directory as it is now
+DirectoryRef directory_ref(DirectoryId id)
+{
+    return {id, directories[id].generation.load(std::memory_order_acquire)};
+}
+
+// Function to check, with the directory locked, that a reference still names
+// the same directory
+bool is_current(const DirectoryRef &ref)
+{
+    return directories[ref.id].generation.load(std::memory_order_acquire) == ref.generation;
+}
+
+// Function to allocate a directory node and return a reference to it. The
+// node is unreachable until the caller links it into its parent, so it is
+// filled in without taking its lock.
+DirectoryRef new_directory(EntryName name, DirectoryRef parent, Attributes attributes)
+{
+    DirectoryId id = directories.allocate();
+    Directory &dir = directories[id];
+    dir.name = name;
+    dir.parent = parent.id;
+    dir.parent_generation = parent.generation;
+    dir.entries.clear();
+    dir.attributes.store(attributes, std::memory_order_relaxed);
+    dir.image_node.store(no_image_node, std::memory_order_relaxed);
+    return {id, dir.generation.load(std::memory_order_relaxed)};
+}
+
+// A set of tasks that a caller waits for as a unit
+struct TaskGroup
+{
+    std::atomic<std::size_t> pending{0};
+};
+
+// Work-stealing thread pool for walking subtrees. Each worker owns a deque:
+// it pushes and pops at the back, so it goes depth-first and keeps little in
+// flight, while idle workers steal from the front, where the largest
+// unexplored subtrees sit. Threads outside the pool submit to a shared queue
+// and run tasks themselves while they wait, so a walk uses every core and a
+// session waiting on its own tasks cannot starve.
+class WorkPool
+{
+public:
+    explicit WorkPool(std::size_t workers) : worker_count(workers), queues(workers + 1)
+    {
+        threads.reserve(workers);
+        for (std::size_t i = 0; i < workers; i++)
+        {
+            threads.emplace_back([this, i]
+                                 { run_worker(i); });
+        }
+    }
+
+    ~WorkPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    void submit(TaskGroup &group, std::function<void()> run)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Queue &queue = queues[own_queue()];
+        {
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            queue.tasks.push_back({&group, std::move(run)});
+        }
+        queued.fetch_add(1);
+        if (sleeping.load() > 0)
+        {
+            std::lock_guard<std::mutex> guard(sleep_mutex);
+            wake.notify_one();
+        }
+    }
+
+    // Run queued tasks, from any group, until done() holds
+    template <typename Done>
+    void help_until(Done done)
+    {
+        while (!done())
+        {
+            if (!run_one())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void wait(TaskGroup &group)
+    {
+        help_until([&]
+                   { return group.pending.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    struct Task
+    {
+        TaskGroup *group;
+        std::function<void()> run;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static thread_local std::size_t worker_index;
+
+    // Workers use their own deque; every other thread shares the last one
+    std::size_t own_queue() const
+    {
+        return std::min(worker_index, worker_count);
+    }
+
+    bool take(Queue &queue, bool from_back, Task &task)
+    {
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            return false;
+        }
+        if (from_back)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queued.fetch_sub(1);
+        return true;
+    }
+
+    bool run_one()
+    {
+        std::size_t self = own_queue();
+        Task task;
+        bool found = take(queues[self], self < worker_count, task);
+        for (std::size_t i = 1; !found && i < queues.size(); i++)
+        {
+            found = take(queues[(self + i) % queues.size()], false, task);
+        }
+        if (!found)
+        {
+            return false;
+        }
+        task.run();
+        task.group->pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void run_worker(std::size_t index)
+    {
+        worker_index = index;
+        while (true)
+        {
+            if (run_one())
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleep_mutex);
+            sleeping.fetch_add(1);
+            wake.wait(guard, [this]
+                      { return stopping || queued.load() > 0; });
+            sleeping.fetch_sub(1);
+            if (stopping && queued.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    const std::size_t worker_count;
+    std::vector<Queue> queues;
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> queued{0};
+    std::atomic<std::size_t> sleeping{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+thread_local std::size_t WorkPool::worker_index = static_cast<std::size_t>(-1);
+
+// Function to return the shared pool, sized so that the workers plus the
+// calling thread cover every core
+WorkPool &work_pool()
+{
+    static WorkPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+// Function to return a directory node and all of its descendants to the free
+// list, one pool task per directory. Each node is invalidated under its own
+// lock, so sessions holding references into the subtree see it vanish instead
+// of reading freed memory. Children not yet read from the image are never
+// loaded; the next save drops them.
+void free_directory(DirectoryId top)
+{
+    WorkPool &pool = work_pool();
+    TaskGroup group;
+    std::function<void(DirectoryId)> free_node = [&](DirectoryId id)
+    {
+        Directory &dir = directories[id];
+        {
+            std::unique_lock<std::shared_mutex> guard(dir.lock);
+            dir.generation.fetch_add(1, std::memory_order_release);
+            for (const DirectoryEntry &entry : dir.entries)
+            {
+                if (entry.kind == EntryKind::directory)
+                {
+                    pool.submit(group, [&free_node, child = entry.directory]
+                                { free_node(child); });
+                }
+                else
+                {
+                    free_inode(entry.file.inode);
+                }
+            }
+            dir.entries.clear();
+            dir.name = EntryName();
+            dir.image_node.store(no_image_node, std::memory_order_relaxed);
+        }
+        directories.release(id);
+    };
+    free_node(top);
+    pool.wait(group);
+}
+
+void materialize(DirectoryId id);
+
+// Function to make sure a directory's children have been read from the image
+void ensure_materialized(const DirectoryRef &ref)
+{
+    Directory &dir = directories[ref.id];
+    if (dir.image_node.load(std::memory_order_acquire) != no_image_node)
+    {
+        std::unique_lock<std::shared_mutex> guard(dir.lock);
+        if (is_current(ref))
+        {
+            materialize(ref.id);
+        }
+    }
+}
+
+// Function to look up a name in a directory, going through the dentry cache.
+// The entry's attributes come back with it, so permission checks along a
+// path need no extra trip to the node. A stale parent reads as an empty
+// directory.
+EntryKind lookup(DirectoryRef parent, std::string_view name, DirectoryRef &target, Attributes &attributes)
+{
+    DentryName key(name);
+    std::size_t slot = dentry_slot(parent.id, name);
+    EntryKind kind;
+    if (key.cacheable && dentry_get(slot, parent, key, kind, target, attributes))
+    {
+        return kind;
+    }
+
+    ensure_materialized(parent);
+    Directory &dir = directories[parent.id];
+    std::shared_lock<std::shared_mutex> guard(dir.lock);
+    kind = EntryKind::none;
+    target = {no_directory, 0};
+    attributes = 0;
+    if (!is_current(parent))
+    {
+        return kind;
+    }
+
+    const DirectoryEntry *entry = dir.entries.find(name);
+    if (entry && entry->kind == EntryKind::directory)
+    {
+        kind = EntryKind::directory;
+        target = directory_ref(entry->directory);
+        attributes = directories[entry->directory].attributes.load(std::memory_order_relaxed);
+    }
+    else if (entry)
+    {
+        kind = EntryKind::file;
+        attributes = entry->file.attributes;
+    }
+
+    if (key.cacheable)
+    {
+        dentry_put(slot, parent, key, kind, target, attributes);
+    }
+    return kind;
+}
+
+// Metadata journal. Every namespace change (mkdir, rmdir, rm -r, file
+// creation, rm, chmod, cp) is appended as a checksummed record naming its
+// absolute path; load replays the records written since the image was saved,
+// so recovery costs grow with the journal tail, not with the tree. File data
+// is not journaled: contents written since the last save are lost on a crash.
+//
+//   header: magic | checkpoint id of the image the journal belongs to
+//   record: JournalRecord | path bytes (two paths for a copy, '\0'-separated)
+//
+// Records are appended to an in-memory buffer while the changed directory is
+// locked, so their order matches the order the changes took effect. A
+// session then waits for its last record with journal_commit: the first
+// waiter writes and syncs everything buffered so far, and waiters arriving
+// meanwhile are covered by the next flush, so concurrent sessions share one
+// sync instead of paying one each. A torn record at the end of the file fails
+// its checksum and is dropped on recovery. If a flush fails the journal is
+// marked failed, since later records would follow a hole: commits fail and
+// journaled commands are refused until a save starts a new journal.
+const char journal_magic[8] = {'O', 'S', 'L', 'A', 'B', 'J', 'N', '1'};
+
+enum class JournalOp : std::uint8_t
+{
+    mkdir = 1,
+    rmdir,
+    remove_tree,
+    create,
+    unlink,
+    chmod,
+    copy_file,
+    copy_tree
+};
+
+struct JournalRecord
+{
+    std::uint32_t length;   // bytes of path following the record
+    std::uint32_t checksum; // CRC-32 of the rest of the record and the path
+    JournalOp op;
+    std::uint8_t unused;
+    std::uint16_t mode;
+    std::uint32_t uid, gid;
+};
+
+// An open journal file, written with plain system calls so it can be synced
+struct JournalFile
+{
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
+
+struct Journal
+{
+    JournalFile file;
+    std::string image; // path of the image the journal belongs to
+    std::mutex mutex;
+    std::condition_variable flushed;
+    std::string pending, writing; // records not yet handed to the file, and the batch being written
+    std::uint64_t appended = 0;   // sequence number of the last record appended
+    std::uint64_t durable = 0;    // sequence number of the last record synced
+    bool flushing = false;
+    bool failed = false; // a flush failed; nothing more is written
+    std::uint64_t records = 0, flushes = 0, bytes = 0;
+    std::uint64_t replayed = 0; // records redone when the image was loaded
+};
+
+Journal journal;
+std::atomic<bool> journal_active{false};
+std::uint64_t image_checkpoint = 0; // id of the image the tree was loaded from or last saved to
+
+// Function to make a checkpoint id for a new image. Ids are random rather
+// than counted, so a journal left beside a path by some other tree, which
+// would have counted up the same way, is never taken for the new image's.
+std::uint64_t new_checkpoint()
+{
+    static std::mt19937_64 rng = []()
+    {
+        std::random_device device;
+        std::seed_seq seed = {device(), device(), device(), device(),
+                              static_cast<unsigned>(std::chrono::system_clock::now().time_since_epoch().count())};
+        return std::mt19937_64(seed);
+    }();
+    std::uint64_t id;
+    do
+    {
+        id = rng();
+    } while (id == 0 || id == image_checkpoint);
+    return id;
+}
+
+// Function to compute a CRC-32 (IEEE) over data, continuing from crc
+std::uint32_t crc32(std::uint32_t crc, const char *data, std::size_t size)
+{
+    static const std::array<std::uint32_t, 256> table = []
+    {
+        std::array<std::uint32_t, 256> entries;
+        for (std::uint32_t i = 0; i < 256; i++)
+        {
+            std::uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Function to open a file for appending after cutting it to length bytes
+bool open_append(const std::string &path, std::uint64_t length, JournalFile &file)
+{
+#ifdef _WIN32
+    file.handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file.handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER offset;
+    offset.QuadPart = static_cast<LONGLONG>(length);
+    if (!SetFilePointerEx(file.handle, offset, nullptr, FILE_BEGIN) || !SetEndOfFile(file.handle))
+    {
+        CloseHandle(file.handle);
+        file.handle = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    return true;
+#else
+    file.fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (file.fd < 0)
+    {
+        return false;
+    }
+    if (::ftruncate(file.fd, static_cast<off_t>(length)) != 0 || ::lseek(file.fd, 0, SEEK_END) < 0)
+    {
+        ::close(file.fd);
+        file.fd = -1;
+        return false;
+    }
+    return true;
+#endif
+}
+
+// Function to write all of data at the end of an open file
+bool write_all(JournalFile &file, const char *data, std::size_t size)
+{
+    while (size > 0)
+    {
+#ifdef _WIN32
+        DWORD written;
+        if (!WriteFile(file.handle, data, static_cast<DWORD>(std::min<std::size_t>(size, 1u << 30)), &written, nullptr))
+        {
+            return false;
+        }
+#else
+        ssize_t written = ::write(file.fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+#endif
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Function to force an open file's data to stable storage
+bool sync_file(JournalFile &file)
+{
+#ifdef _WIN32
+    return FlushFileBuffers(file.handle) != 0;
+#else
+    return ::fsync(file.fd) == 0;
+#endif
+}
+
+void close_file(JournalFile &file)
+{
+#ifdef _WIN32
+    if (file.handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file.handle);
+        file.handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (file.fd >= 0)
+    {
+        ::close(file.fd);
+        file.fd = -1;
+    }
+#endif
+}
+
+// Function to sync a file that was written through a stream, before it is
+// renamed into place
+bool sync_path(const std::string &path)
+{
+    JournalFile file;
+#ifdef _WIN32
+    file.handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    bool ok = file.handle != INVALID_HANDLE_VALUE && sync_file(file);
+#else
+    file.fd = ::open(path.c_str(), O_RDONLY);
+    bool ok = file.fd >= 0 && sync_file(file);
+#endif
+    close_file(file);
+    return ok;
+}
+
+// Function to return the journal that goes with an image
+std::string journal_path(const std::string &image_path)
+{
+    return image_path + ".journal";
+}
+
+// Function to detach the journal; records not yet committed are dropped.
+// Sequence numbers keep counting across journals, and everything appended so
+// far counts as durable, since it is either in the saved image or discarded
+// with the tree; sessions waiting on an older number return at once.
+void journal_close()
+{
+    journal_active.store(false);
+    close_file(journal.file);
+    journal.pending.clear();
+    journal.durable = journal.appended;
+    journal.failed = false;
+    journal.records = journal.flushes = journal.bytes = journal.replayed = 0;
+}
+
+// Function to attach the journal of an image, keeping its first length bytes
+// (the records already replayed) or writing a fresh header when length is 0
+bool journal_open(const std::string &image_path, std::uint64_t length)
+{
+    journal_close();
+    journal.image = image_path;
+    if (!open_append(journal_path(image_path), length, journal.file))
+    {
+        return false;
+    }
+    if (length == 0)
+    {
+        char header[16];
+        std::memcpy(header, journal_magic, sizeof(journal_magic));
+        std::memcpy(header + 8, &image_checkpoint, sizeof(image_checkpoint));
+        if (!write_all(journal.file, header, sizeof(header)) || !sync_file(journal.file))
+        {
+            close_file(journal.file);
+            return false;
+        }
+    }
+    journal.bytes = length == 0 ? 16 : length;
+    journal_active.store(true);
+    return true;
+}
+
+// Function to append a record to the journal buffer and return its sequence
+// number, or 0 if no journal is attached. Called with the changed directory
+// locked.
+std::uint64_t journal_append(JournalOp op, std::uint32_t uid, std::uint32_t gid, std::string_view path, unsigned mode = 0)
+{
+    if (!journal_active.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    JournalRecord record = {};
+    record.length = static_cast<std::uint32_t>(path.size());
+    record.op = op;
+    record.mode = static_cast<std::uint16_t>(mode);
+    record.uid = uid;
+    record.gid = gid;
+    const char *body = reinterpret_cast<const char *>(&record) + offsetof(JournalRecord, op);
+    record.checksum = crc32(crc32(0, body, sizeof(record) - offsetof(JournalRecord, op)), path.data(), path.size());
+
+    std::lock_guard<std::mutex> guard(journal.mutex);
+    if (!journal.failed)
+    {
+        journal.pending.append(reinterpret_cast<const char *>(&record), sizeof(record));
+        journal.pending.append(path.data(), path.size());
+        journal.records++;
+    }
+    return ++journal.appended;
+}
+
+// Function to wait until the record with sequence number lsn, and everything
+// before it, is on stable storage. Whoever finds no flush in progress writes
+// and syncs the whole buffer for everyone waiting.
+bool journal_commit(std::uint64_t lsn)
+{
+    if (lsn == 0)
+    {
+        return true;
+    }
+    std::unique_lock<std::mutex> guard(journal.mutex);
+    while (journal.durable < lsn)
+    {
+        if (journal.failed)
+        {
+            return false;
+        }
+        if (journal.flushing)
+        {
+            journal.flushed.wait(guard);
+            continue;
+        }
+        journal.flushing = true;
+        journal.writing.swap(journal.pending);
+        std::uint64_t upto = journal.appended;
+        guard.unlock();
+        bool ok = write_all(journal.file, journal.writing.data(), journal.writing.size()) && sync_file(journal.file);
+        guard.lock();
+        journal.bytes += journal.writing.size();
+        journal.writing.clear();
+        journal.flushing = false;
+        journal.flushes++;
+        if (!ok)
+        {
+            journal.failed = true;
+            journal.pending.clear();
+        }
+        else
+        {
+            journal.durable = upto;
+        }
+        journal.flushed.notify_all();
+    }
+    return true;
+}
+
+// Function to tell whether the journal has stopped after a failed flush
+bool journal_failed()
+{
+    std::lock_guard<std::mutex> guard(journal.mutex);
+    return journal.failed;
+}
+
+// Function to make every record appended so far durable
+bool journal_commit_all()
+{
+    std::uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> guard(journal.mutex);
+        lsn = journal.appended;
+    }
+    return journal_commit(lsn);
+}
+
+// Layout of a filesystem image. All offsets are from the start of the file and
+// every table is 8-byte aligned; the data blocks start on a block boundary so
+// the image can be mapped and used in place.
+//
+//   header | nodes | name offsets + name bytes | inodes | data blocks
+//
+// Nodes are laid out breadth-first so the children of a directory are one
+// contiguous run of the node table. Names are interned: each distinct name is
+// stored once. Every file's data is compacted into a single extent.
+const char image_magic[8] = {'O', 'S', 'L', 'A', 'B', 'F', 'S', '3'};
+
+struct ImageHeader
+{
+    char magic[8];
+    std::uint64_t node_count, node_offset;
+    std::uint64_t name_count, name_offset; // name_count + 1 offsets, then the bytes
+    std::uint64_t inode_count, inode_offset;
+    std::uint64_t block_count, block_offset;
+    std::uint64_t checkpoint; // matched against the journal header on load
+};
+
+struct ImageNode
+{
+    std::uint32_t name;        // index into the name table
+    std::uint32_t is_file;
+    std::uint32_t first_child; // directories: children are [first_child, first_child + child_count)
+    std::uint32_t child_count;
+    std::uint32_t inode;       // files only
+    std::uint32_t mode;
+    std::uint32_t uid;
+    std::uint32_t gid;
+};
+
+struct ImageInode
+{
+    std::uint64_t size;
+    std::uint64_t first_block;
+    std::uint64_t block_count;
+    char inline_data[64];
+};
+
+// A read-only file mapped privately: pages are faulted in on first touch and
+// writes stay in this process
+struct MappedImage
+{
+    char *data = nullptr;
+    std::size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+MappedImage mapped_image;
+
+// Function to map an image file copy-on-write
+bool map_image(const std::string &path, MappedImage &image)
+{
+#ifdef _WIN32
+    image.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (image.file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(image.file, &size);
+    image.size = static_cast<std::size_t>(size.QuadPart);
+    image.mapping = image.size ? CreateFileMappingA(image.file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+    image.data = image.mapping ? static_cast<char *>(MapViewOfFile(image.mapping, FILE_MAP_COPY, 0, 0, 0)) : nullptr;
+    if (!image.data)
+    {
+        if (image.mapping)
+        {
+            CloseHandle(image.mapping);
+        }
+        CloseHandle(image.file);
+        image = {};
+        return false;
+    }
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    image.data = static_cast<char *>(data);
+    image.size = st.st_size;
+    return true;
+#endif
+}
+
+// Function to release a mapped image
+void unmap_image(MappedImage &image)
+{
+    if (!image.data)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(image.data);
+    CloseHandle(image.mapping);
+    CloseHandle(image.file);
+#else
+    ::munmap(image.data, image.size);
+#endif
+    image = {};
+}
+
+// Function to return a table inside the mapped image
+template <typename T>
+const T *image_table(std::uint64_t offset)
+{
+    return reinterpret_cast<const T *>(mapped_image.data + offset);
+}
+
+// Function to read an interned name from the mapped image
+std::string_view image_name(std::uint32_t name)
+{
+    const ImageHeader &header = *image_table<ImageHeader>(0);
+    const std::uint64_t *offsets = image_table<std::uint64_t>(header.name_offset);
+    const char *bytes = reinterpret_cast<const char *>(offsets + header.name_count + 1);
+    return {bytes + offsets[name], offsets[name + 1] - offsets[name]};
+}
+
+// Function to read a node's attributes from the image
+Attributes image_attributes(const ImageNode &node)
+{
+    return make_attributes(node.mode, node.uid, node.gid);
+}
+
+// Function to pull a directory's children out of the image the first time
+// the directory is used. File data is not copied: loaded inodes point at
+// blocks inside the mapping. The caller holds the directory's lock exclusively.
+void materialize(DirectoryId id)
+{
+    Directory &dir = directories[id];
+    std::uint32_t image_node = dir.image_node.load(std::memory_order_relaxed);
+    if (image_node == no_image_node)
+    {
+        return;
+    }
+
+    DirectoryRef self = {id, dir.generation.load(std::memory_order_relaxed)};
+    const ImageHeader &header = *image_table<ImageHeader>(0);
+    const ImageNode *nodes = image_table<ImageNode>(header.node_offset);
+    const ImageInode *image_inodes = image_table<ImageInode>(header.inode_offset);
+    const ImageNode &node = nodes[image_node];
+    for (std::uint32_t i = node.first_child; i < node.first_child + node.child_count; i++)
+    {
+        EntryName name(image_name(nodes[i].name));
+        if (nodes[i].is_file)
+        {
+            const ImageInode &image_inode = image_inodes[nodes[i].inode];
+            InodeId inode_id = new_inode();
+            Inode &inode = inodes[inode_id];
+            inode.size = image_inode.size;
+            if (image_inode.block_count)
+            {
+                inode.extents.push_back({image_inode.first_block, image_inode.block_count});
+            }
+            else
+            {
+                std::memcpy(inode.inline_data, image_inode.inline_data, inline_capacity);
+            }
+            dir.entries.insert(file_entry(name, {image_attributes(nodes[i]), inode_id}));
+        }
+        else
+        {
+            DirectoryRef child = new_directory(name, self, image_attributes(nodes[i]));
+            directories[child.id].image_node.store(i, std::memory_order_release);
+            dir.entries.insert(directory_entry(name, child.id));
+        }
+    }
+    dir.image_node.store(no_image_node, std::memory_order_release);
+}
+
+// Function to write the whole tree to an image file. The image is written
+// next to the target, synced and renamed over it, so a mapped image stays
+// valid. Saving is also the journal's checkpoint: the image gets a new
+// checkpoint id and a fresh, empty journal is started for it, so a crash at
+// any point leaves either the old image with its journal or the new image
+// with a journal it does not recognize. Other sessions must be idle while
+// saving.
+bool save(const std::string &path)
+{
+    auto image_node = [](std::uint32_t name, std::uint32_t is_file, std::uint32_t inode, Attributes attributes) -> ImageNode
+    { return {name, is_file, 0, 0, inode, attributes_mode(attributes), attributes_uid(attributes), attributes_gid(attributes)}; };
+
+    std::vector<ImageNode> nodes = {image_node(0, 0, 0, directories[root].attributes)};
+    std::vector<DirectoryId> node_directories = {root};
+    std::vector<std::string> names = {std::string(directories[root].name.view())};
+    std::unordered_map<std::string, std::uint32_t> name_ids = {{names[0], 0}};
+    std::vector<ImageInode> image_inodes;
+    std::vector<InodeId> data_inodes;
+    std::uint64_t blocks = 0;
+
+    auto intern = [&](const std::string &name)
+    {
+        auto it = name_ids.emplace(name, static_cast<std::uint32_t>(names.size()));
+        if (it.second)
+        {
+            names.push_back(name);
+        }
+        return it.first->second;
+    };
+
+    for (std::size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].is_file)
+        {
+            continue;
+        }
+        DirectoryId id = node_directories[i];
+        ensure_materialized(directory_ref(id));
+        const Directory &dir = directories[id];
+        nodes[i].first_child = static_cast<std::uint32_t>(nodes.size());
+        nodes[i].child_count = static_cast<std::uint32_t>(dir.entries.directory_count() + dir.entries.file_count());
+        for (const DirectoryEntry &entry : dir.entries)
+        {
+            std::string name(entry.name.view());
+            if (entry.kind == EntryKind::directory)
+            {
+                nodes.push_back(image_node(intern(name), 0, 0, directories[entry.directory].attributes));
+                node_directories.push_back(entry.directory);
+                continue;
+            }
+            const Inode &inode = inodes[entry.file.inode];
+            ImageInode image_inode = {inode.size, 0, inode_blocks(inode), {}};
+            if (inode.extents.empty())
+            {
+                std::memcpy(image_inode.inline_data, inode.inline_data, inline_capacity);
+            }
+            else
+            {
+                image_inode.first_block = blocks;
+                blocks += image_inode.block_count;
+                data_inodes.push_back(entry.file.inode);
+            }
+            nodes.push_back(image_node(intern(name), 1, static_cast<std::uint32_t>(image_inodes.size()), entry.file.attributes));
+            node_directories.push_back(no_directory);
+            image_inodes.push_back(image_inode);
+        }
+    }
+
+    std::vector<std::uint64_t> name_offsets = {0};
+    for (const std::string &name : names)
+    {
+        name_offsets.push_back(name_offsets.back() + name.size());
+    }
+
+    auto align = [](std::uint64_t offset, std::uint64_t to)
+    { return (offset + to - 1) / to * to; };
+
+    ImageHeader header;
+    std::memcpy(header.magic, image_magic, sizeof(image_magic));
+    header.node_count = nodes.size();
+    header.node_offset = align(sizeof(ImageHeader), 8);
+    header.name_count = names.size();
+    header.name_offset = align(header.node_offset + nodes.size() * sizeof(ImageNode), 8);
+    header.inode_count = image_inodes.size();
+    header.inode_offset = align(header.name_offset + name_offsets.size() * sizeof(std::uint64_t) + name_offsets.back(), 8);
+    header.block_count = blocks;
+    header.block_offset = align(header.inode_offset + image_inodes.size() * sizeof(ImageInode), block_size);
+    header.checkpoint = new_checkpoint();
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    auto pad_to = [&](std::uint64_t offset)
+    {
+        static const char zeros[block_size] = {};
+        out.write(zeros, offset - static_cast<std::uint64_t>(out.tellp()));
+    };
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    pad_to(header.node_offset);
+    out.write(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(ImageNode));
+    pad_to(header.name_offset);
+    out.write(reinterpret_cast<const char *>(name_offsets.data()), name_offsets.size() * sizeof(std::uint64_t));
+    for (const std::string &name : names)
+    {
+        out.write(name.data(), name.size());
+    }
+    pad_to(header.inode_offset);
+    out.write(reinterpret_cast<const char *>(image_inodes.data()), image_inodes.size() * sizeof(ImageInode));
+    pad_to(header.block_offset);
+    {
+        std::shared_lock<std::shared_mutex> guard(store_lock);
+        for (InodeId inode : data_inodes)
+        {
+            for (const Extent &extent : inodes[inode].extents)
+            {
+                out.write(block_data(extent.start), extent.count * block_size);
+            }
+        }
+    }
+    out.close();
+    if (!out || !sync_path(tmp_path))
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    if (!MoveFileExA(tmp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        return false;
+    }
+#else
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        return false;
+    }
+    std::size_t slash = path.rfind('/');
+    sync_path(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+#endif
+    image_checkpoint = header.checkpoint;
+    return journal_open(path, 0);
+}
+
+// Function to check that an image's tables lie inside the file
+bool image_valid(const MappedImage &image)
+{
+    if (image.size < sizeof(ImageHeader))
+    {
+        return false;
+    }
+    const ImageHeader &header = *reinterpret_cast<const ImageHeader *>(image.data);
+    return std::memcmp(header.magic, image_magic, sizeof(image_magic)) == 0 &&
+           header.node_count > 0 &&
+           header.node_offset + header.node_count * sizeof(ImageNode) <= image.size &&
+           header.name_offset + (header.name_count + 1) * sizeof(std::uint64_t) <= image.size &&
+           header.inode_offset + header.inode_count * sizeof(ImageInode) <= image.size &&
+           header.block_offset % block_size == 0 &&
+           header.block_offset + header.block_count * block_size <= image.size;
+}
+
+// Function to start an empty tree
+void format()
+{
+    root = new_directory(EntryName("root"), {no_directory, 0}, make_attributes(default_directory_mode, 0, 0)).id;
+}
+
+bool journal_recover(const std::string &image_path);
+
+// Function to replace the whole tree with an image file, then bring it up to
+// date from the image's journal. Only the root is set up here; directories
+// are read from the mapping as they are reached. Other sessions must be idle,
+// and every session's working directory must be reset afterwards.
+bool load(const std::string &path)
+{
+    MappedImage image;
+    if (!map_image(path, image))
+    {
+        return false;
+    }
+    if (!image_valid(image))
+    {
+        unmap_image(image);
+        return false;
+    }
+
+    journal_commit_all();
+    journal_close();
+    directories.clear();
+    inodes.clear();
+    names.clear();
+    block_store.clear();
+    free_extents_by_start.clear();
+    free_extents_by_length.clear();
+    dentry_clear();
+    unmap_image(mapped_image);
+    mapped_image = image;
+
+    const ImageHeader &header = *image_table<ImageHeader>(0);
+    image_block_base = mapped_image.data + header.block_offset;
+    image_blocks = header.block_count;
+
+    const ImageNode &node = image_table<ImageNode>(header.node_offset)[0];
+    root = new_directory(EntryName(image_name(node.name)), {no_directory, 0}, image_attributes(node)).id;
+    directories[root].image_node.store(0, std::memory_order_release);
+    image_checkpoint = header.checkpoint;
+    return journal_recover(path);
+}
+
+// Per-client state. Every command runs against a session, so many clients
+// can share one tree, each with its own working directory, identity and
+// output stream. uid 0 is the superuser.
+struct Session
+{
+    DirectoryRef cwd;
+    std::ostream *out;
+    std::uint32_t uid;
+    std::uint32_t gid;
+    std::string cwd_path;  // absolute path of cwd, for journal records
+    std::uint64_t lsn = 0; // last journal record this session appended
+};
+
+// Outcome of a command: failed covers missing entries and other refusals,
+// denied is a permission check that did not pass
+enum class Status
+{
+    ok,
+    failed,
+    denied
+};
+
+// Function to open a session at the root directory
+Session new_session(std::ostream &out, std::uint32_t uid = 0, std::uint32_t gid = 0)
+{
+    return {directory_ref(root), &out, uid, gid, "/"};
+}
+
+// Function to work out which of rwx a session is granted on a node
+unsigned access_bits(const Session &session, Attributes attributes)
+{
+    if (session.uid == 0)
+    {
+        return mode_read | mode_write | mode_execute;
+    }
+    unsigned mode = attributes_mode(attributes);
+    if (attributes_uid(attributes) == session.uid)
+    {
+        return mode >> 6;
+    }
+    if (attributes_gid(attributes) == session.gid)
+    {
+        return (mode >> 3) & 7;
+    }
+    return mode & 7;
+}
+
+// Function to check that a session has every bit of want on a node
+bool permitted(const Session &session, Attributes attributes, unsigned want)
+{
+    return (access_bits(session, attributes) & want) == want;
+}
+
+// Function to walk a path one component at a time; absolute paths start at
+// root, relative ones at the session's working directory. "." and ".." are
+// handled here, and ".." at root stays at root. Every directory walked
+// through must grant search (execute) permission; attributes comes back
+// with those of the final directory.
+Status resolve(const Session &session, std::string_view path, DirectoryRef &dir, Attributes &attributes)
+{
+    dir = (!path.empty() && path[0] == '/') ? directory_ref(root) : session.cwd;
+    attributes = directories[dir.id].attributes.load(std::memory_order_relaxed);
+
+    std::size_t pos = 0;
+    while (pos < path.size())
+    {
+        std::size_t end = path.find('/', pos);
+        if (end == std::string_view::npos)
+        {
+            end = path.size();
+        }
+        std::string_view component = path.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (component.empty() || component == ".")
+        {
+            continue;
+        }
+        if (!permitted(session, attributes, mode_execute))
+        {
+            return Status::denied;
+        }
+        if (component == "..")
+        {
+            if (dir.id != root)
+            {
+                Directory &node = directories[dir.id];
+                std::shared_lock<std::shared_mutex> guard(node.lock);
+                if (!is_current(dir))
+                {
+                    return Status::failed;
+                }
+                dir = {node.parent, node.parent_generation};
+                attributes = directories[dir.id].attributes.load(std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        DirectoryRef next;
+        if (lookup(dir, component, next, attributes) != EntryKind::directory)
+        {
+            return Status::failed;
+        }
+        dir = next;
+    }
+    return Status::ok;
+}
+
+// Function to split a path into its parent directory and final name, for
+// commands that act on an entry; the parent must grant search permission
+Status resolve_parent(const Session &session, std::string_view path, DirectoryRef &parent, Attributes &attributes, std::string_view &name)
+{
+    while (path.size() > 1 && path.back() == '/')
+    {
+        path.remove_suffix(1);
+    }
+
+    std::size_t slash = path.rfind('/');
+    if (slash == std::string_view::npos)
+    {
+        parent = session.cwd;
+        attributes = directories[parent.id].attributes.load(std::memory_order_relaxed);
+        name = path;
+    }
+    else
+    {
+        std::string_view parent_path = slash == 0 ? path.substr(0, 1) : path.substr(0, slash);
+        Status status = resolve(session, parent_path, parent, attributes);
+        if (status != Status::ok)
+        {
+            return status;
+        }
+        name = path.substr(slash + 1);
+    }
+    if (name.empty() || name == "." || name == "..")
+    {
+        return Status::failed;
+    }
+    return permitted(session, attributes, mode_execute) ? Status::ok : Status::denied;
+}
+
+// Function to resolve the parent of a path and check that entries may be
+// created or removed in it, which needs write as well as search
+Status resolve_parent_for_update(const Session &session, std::string_view path, DirectoryRef &parent, std::string_view &name)
+{
+    Attributes attributes;
+    Status status = resolve_parent(session, path, parent, attributes, name);
+    if (status == Status::ok && !permitted(session, attributes, mode_write))
+    {
+        return Status::denied;
+    }
+    return status;
+}
+
+// Function to list a directory's ancestors, itself included, taking one lock
+// at a time
+std::vector<DirectoryId> ancestors_of(DirectoryRef ref)
+{
+    std::vector<DirectoryId> ancestors;
+    while (ref.id != no_directory)
+    {
+        Directory &node = directories[ref.id];
+        std::shared_lock<std::shared_mutex> guard(node.lock);
+        if (!is_current(ref))
+        {
+            break;
+        }
+        ancestors.push_back(ref.id);
+        ref = {node.parent, node.parent_generation};
+    }
+    return ancestors;
+}
+
+// Function to append a name to a path
+std::string join_path(const std::string &path, std::string_view name)
+{
+    std::string joined = path;
+    if (joined.empty() || joined.back() != '/')
+    {
+        joined += '/';
+    }
+    joined += name;
+    return joined;
+}
+
+// Function to build the path a record names: absolute paths as given,
+// relative ones joined to the session's working directory. Empty while no
+// journal is attached, so unjournaled trees pay nothing.
+std::string journal_target(const std::string &cwd_path, const std::string &path)
+{
+    if (!journal_active.load(std::memory_order_relaxed))
+    {
+        return {};
+    }
+    return !path.empty() && path[0] == '/' ? path : join_path(cwd_path, path);
+}
+
+// Function to journal a change made by a session, with the changed directory
+// still locked; target is empty when no journal is attached
+void record_change(Session &session, JournalOp op, const std::string &target, unsigned mode = 0)
+{
+    if (!target.empty())
+    {
+        session.lsn = journal_append(op, session.uid, session.gid, target, mode);
+    }
+}
+
+// Output shared by the tasks of one recursive command. Each task fills a
+// local buffer and hands it over in large pieces, so results stream out while
+// the walk is still running rather than after it.
+struct OutputSink
+{
+    static const std::size_t chunk = 64 * 1024;
+
+    explicit OutputSink(std::ostream &stream) : out(&stream) {}
+
+    void flush(std::string &buffer)
+    {
+        if (!buffer.empty())
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            out->write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    void flush_if_full(std::string &buffer)
+    {
+        if (buffer.size() >= chunk)
+        {
+            flush(buffer);
+        }
+    }
+
+    std::ostream *out;
+    std::mutex mutex;
+};
+
+// Function to visit every directory of the subtree at top in parallel, one
+// pool task per directory, in no particular order. visit(path, dir, out) runs
+// with the directory's lock held shared and may append output to out.
+// Directories the session may not list are reported and skipped; returns
+// false if there were any.
+template <typename Visit>
+bool walk(const Session &session, DirectoryRef top, Attributes attributes, const std::string &path, OutputSink &sink, Visit &visit)
+{
+    WorkPool &pool = work_pool();
+    TaskGroup group;
+    std::atomic<bool> complete{true};
+    std::function<void(DirectoryRef, Attributes, const std::string &)> visit_directory =
+        [&](DirectoryRef ref, Attributes dir_attributes, const std::string &dir_path)
+    {
+        std::string out;
+        if (!permitted(session, dir_attributes, mode_read | mode_execute))
+        {
+            out += "Error: Permission denied: " + dir_path + "\n";
+            complete.store(false, std::memory_order_relaxed);
+        }
+        else
+        {
+            ensure_materialized(ref);
+            Directory &dir = directories[ref.id];
+            std::shared_lock<std::shared_mutex> guard(dir.lock);
+            if (is_current(ref))
+            {
+                visit(dir_path, dir, out);
+                for (const DirectoryEntry &entry : dir.entries)
+                {
+                    if (entry.kind != EntryKind::directory)
+                    {
+                        continue;
+                    }
+                    DirectoryRef child = directory_ref(entry.directory);
+                    Attributes child_attributes = directories[entry.directory].attributes.load(std::memory_order_relaxed);
+                    pool.submit(group, [&visit_directory, child, child_attributes, child_path = join_path(dir_path, entry.name.view())]
+                                { visit_directory(child, child_attributes, child_path); });
+                }
+            }
+        }
+        sink.flush(out);
+    };
+    visit_directory(top, attributes, path);
+    pool.wait(group);
+    return complete.load();
+}
+
+// Options of an ls command
+struct ListQuery
+{
+    std::string path = ".";
+    std::string from;   // first name to print
+    std::string prefix; // only names starting with this
+    std::size_t limit = 0; // 0 for no limit
+};
+
+// Function to print the content of a directory in name order, subdirectories
+// marked with a trailing "/". A page starts at the first name not less than
+// --from and stops after --limit names, ending with the name to pass as
+// --from for the next page, so listing a huge directory costs a search plus
+// the names printed.
+Status ls(Session &session, const ListQuery &query)
+{
+    DirectoryRef ref;
+    Attributes attributes;
+    Status status = resolve(session, query.path, ref, attributes);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    if (!permitted(session, attributes, mode_read))
+    {
+        return Status::denied;
+    }
+
+    ensure_materialized(ref);
+    Directory &dir = directories[ref.id];
+    std::shared_lock<std::shared_mutex> guard(dir.lock);
+    if (!is_current(ref))
+    {
+        return Status::failed;
+    }
+    std::ostream &out = *session.out;
+    std::size_t printed = 0;
+    for (auto it = dir.entries.lower_bound(std::max(query.from, query.prefix)); it != dir.entries.end(); ++it)
+    {
+        std::string_view name = it->name.view();
+        if (name.substr(0, query.prefix.size()) != query.prefix)
+        {
+            break;
+        }
+        if (query.limit != 0 && printed == query.limit)
+        {
+            out << "-- more: --from " << name << "\n";
+            break;
+        }
+        out << name << (it->kind == EntryKind::directory ? "/\n" : "\n");
+        printed++;
+    }
+    return Status::ok;
+}
+
+// Function to build a directory's absolute path by following parent links
+// up to root, one lock at a time
+bool directory_path(DirectoryRef ref, std::string &path)
+{
+    std::vector<std::string> components;
+    while (ref.id != root)
+    {
+        Directory &dir = directories[ref.id];
+        std::shared_lock<std::shared_mutex> guard(dir.lock);
+        if (!is_current(ref))
+        {
+            return false;
+        }
+        components.emplace_back(dir.name.view());
+        ref = {dir.parent, dir.parent_generation};
+    }
+
+    path.clear();
+    for (auto it = components.rbegin(); it != components.rend(); ++it)
+    {
+        path += "/";
+        path += *it;
+    }
+    if (path.empty())
+    {
+        path = "/";
+    }
+    return true;
+}
+
+// Function to print the working directory
+Status pwd(Session &session)
+{
+    std::string path;
+    if (!directory_path(session.cwd, path))
+    {
+        return Status::failed;
+    }
+    *session.out << path << "\n";
+    return Status::ok;
+}
+
+// Function to change directory
+Status cd(Session &session, const std::string &path)
+{
+    DirectoryRef ref;
+    Attributes attributes;
+    Status status = path.empty() ? Status::failed : resolve(session, path, ref, attributes);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    if (!permitted(session, attributes, mode_execute))
+    {
+        return Status::denied;
+    }
+    std::string cwd_path;
+    if (!directory_path(ref, cwd_path))
+    {
+        return Status::failed;
+    }
+    session.cwd = ref;
+    session.cwd_path = std::move(cwd_path);
+    return Status::ok;
+}
+
+// Function to create a new directory
+Status mkdir(Session &session, const std::string &path)
+{
+    DirectoryRef parent;
+    std::string_view name;
+    Status status = resolve_parent_for_update(session, path, parent, name);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    std::string target = journal_target(session.cwd_path, path);
+
+    ensure_materialized(parent);
+    Directory &dir = directories[parent.id];
+    std::unique_lock<std::shared_mutex> guard(dir.lock);
+    if (!is_current(parent) || dir.entries.find(name))
+    {
+        return Status::failed;
+    }
+
+    EntryName dir_name(name);
+    DirectoryRef child = new_directory(dir_name, parent, make_attributes(default_directory_mode, session.uid, session.gid));
+    dir.entries.insert(directory_entry(dir_name, child.id));
+    dentry_invalidate(parent.id, name);
+    record_change(session, JournalOp::mkdir, target);
+    return Status::ok;
+}
+
+// Function to unlink a directory from its parent and free it. Without
+// recursive the directory must be empty; it is checked and invalidated under
+// its own lock, taken while the parent's is held (always parent before
+// child), so no entry can be added between the check and the removal. With
+// recursive every directory below must be writable by the session; entries
+// created in the subtree while it is being removed go with it.
+Status remove_directory(Session &session, const std::string &path, bool recursive)
+{
+    DirectoryRef parent;
+    std::string_view name;
+    Status status = resolve_parent_for_update(session, path, parent, name);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+
+    // A directory containing the working directory is never removed
+    std::vector<DirectoryId> ancestors = ancestors_of(session.cwd);
+    std::string target = journal_target(session.cwd_path, path);
+
+    DirectoryRef child;
+    Attributes attributes;
+    if (lookup(parent, name, child, attributes) != EntryKind::directory)
+    {
+        return Status::failed;
+    }
+    if (recursive)
+    {
+        OutputSink sink(*session.out);
+        std::atomic<bool> writable{true};
+        auto check = [&](const std::string &dir_path, Directory &dir, std::string &out)
+        {
+            if (!permitted(session, dir.attributes.load(std::memory_order_relaxed), mode_write))
+            {
+                out += "Error: Permission denied: " + dir_path + "\n";
+                writable.store(false, std::memory_order_relaxed);
+            }
+        };
+        if (!walk(session, child, attributes, path, sink, check) || !writable.load())
+        {
+            return Status::denied;
+        }
+    }
+    else
+    {
+        ensure_materialized(child);
+    }
+
+    Directory &dir = directories[parent.id];
+    {
+        std::unique_lock<std::shared_mutex> guard(dir.lock);
+        const DirectoryEntry *entry = dir.entries.find(name);
+        if (!is_current(parent) || !entry || entry->kind != EntryKind::directory || entry->directory != child.id ||
+            std::find(ancestors.begin(), ancestors.end(), child.id) != ancestors.end())
+        {
+            return Status::failed;
+        }
+        if (!recursive)
+        {
+            Directory &node = directories[child.id];
+            std::unique_lock<std::shared_mutex> child_guard(node.lock);
+            if (!is_current(child) || !node.entries.empty() ||
+                node.image_node.load(std::memory_order_relaxed) != no_image_node)
+            {
+                return Status::failed;
+            }
+            node.generation.fetch_add(1, std::memory_order_release);
+        }
+        dir.entries.erase(name);
+        dentry_invalidate(parent.id, name);
+        record_change(session, recursive ? JournalOp::remove_tree : JournalOp::rmdir, target);
+    }
+    free_directory(child.id);
+    return Status::ok;
+}
+
+// Function to remove an empty directory
+Status rmdir(Session &session, const std::string &path)
+{
+    return remove_directory(session, path, false);
+}
+
+// Function to create a new file; touching an existing file needs no access
+// to its directory beyond search
+Status touch(Session &session, const std::string &path)
+{
+    DirectoryRef parent;
+    Attributes attributes;
+    std::string_view name;
+    Status status = resolve_parent(session, path, parent, attributes, name);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    std::string target = journal_target(session.cwd_path, path);
+
+    ensure_materialized(parent);
+    Directory &dir = directories[parent.id];
+    std::unique_lock<std::shared_mutex> guard(dir.lock);
+    const DirectoryEntry *entry = dir.entries.find(name);
+    if (!is_current(parent) || (entry && entry->kind == EntryKind::directory))
+    {
+        return Status::failed;
+    }
+    if (!entry)
+    {
+        if (!permitted(session, attributes, mode_write))
+        {
+            return Status::denied;
+        }
+        dir.entries.insert(file_entry(EntryName(name), {make_attributes(default_file_mode, session.uid, session.gid), new_inode()}));
+        dentry_invalidate(parent.id, name);
+        record_change(session, JournalOp::create, target);
+    }
+    return Status::ok;
+}
+
+// Function to remove a file
+Status rm(Session &session, const std::string &path)
+{
+    DirectoryRef parent;
+    std::string_view name;
+    Status status = resolve_parent_for_update(session, path, parent, name);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    std::string target = journal_target(session.cwd_path, path);
+
+    ensure_materialized(parent);
+    Directory &dir = directories[parent.id];
+    std::unique_lock<std::shared_mutex> guard(dir.lock);
+    const DirectoryEntry *entry = dir.entries.find(name);
+    if (!is_current(parent) || !entry || entry->kind != EntryKind::file)
+    {
+        return Status::failed;
+    }
+    free_inode(entry->file.inode);
+    dir.entries.erase(name);
+    dentry_invalidate(parent.id, name);
+    record_change(session, JournalOp::unlink, target);
+    return Status::ok;
+}
+
+// A file found by path, holding its directory's lock for as long as the
+// handle lives: shared for reading, exclusive for writing
+template <typename Lock>
+struct FileHandle
+{
+    Lock guard;
+    File *file = nullptr;
+    std::string_view name; // the file's entry name, valid while guard is held
+    DirectoryId parent = no_directory;
+    Status status = Status::failed;
+};
+
+using ReadHandle = FileHandle<std::shared_lock<std::shared_mutex>>;
+using WriteHandle = FileHandle<std::unique_lock<std::shared_mutex>>;
+
+// Function to find the file at a path, lock its directory and check that the
+// session has every bit of want on the file
+template <typename Handle>
+Handle find_file(Session &session, const std::string &path, unsigned want)
+{
+    Handle handle;
+    DirectoryRef parent;
+    Attributes attributes;
+    std::string_view name;
+    handle.status = resolve_parent(session, path, parent, attributes, name);
+    if (handle.status != Status::ok)
+    {
+        return handle;
+    }
+
+    ensure_materialized(parent);
+    Directory &dir = directories[parent.id];
+    handle.guard = decltype(handle.guard)(dir.lock);
+    DirectoryEntry *entry = dir.entries.find(name);
+    if (!is_current(parent) || !entry || entry->kind != EntryKind::file)
+    {
+        handle.status = Status::failed;
+    }
+    else if (!permitted(session, entry->file.attributes, want))
+    {
+        handle.status = Status::denied;
+    }
+    else
+    {
+        handle.file = &entry->file;
+        handle.name = entry->name.view();
+        handle.parent = parent.id;
+    }
+    return handle;
+}
+
+// Function to replace a file's content, creating the file if needed
+Status write(Session &session, const std::string &path, std::string_view data)
+{
+    Status status = touch(session, path);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    WriteHandle handle = find_file<WriteHandle>(session, path, mode_write);
+    if (!handle.file)
+    {
+        return handle.status;
+    }
+    Inode &inode = inodes[handle.file->inode];
+    inode_resize(inode, 0);
+    inode_write(inode, 0, data);
+    return Status::ok;
+}
+
+// Function to add data to the end of a file, creating the file if needed
+Status append(Session &session, const std::string &path, std::string_view data)
+{
+    Status status = touch(session, path);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    WriteHandle handle = find_file<WriteHandle>(session, path, mode_write);
+    if (!handle.file)
+    {
+        return handle.status;
+    }
+    Inode &inode = inodes[handle.file->inode];
+    inode_write(inode, inode.size, data);
+    return Status::ok;
+}
+
+// Function to print a file's content straight from its extents
+Status cat(Session &session, const std::string &path)
+{
+    ReadHandle handle = find_file<ReadHandle>(session, path, mode_read);
+    if (!handle.file)
+    {
+        return handle.status;
+    }
+    Inode &inode = inodes[handle.file->inode];
+    std::ostream &out = *session.out;
+    inode_spans(inode, 0, inode.size, [&](const char *data, std::size_t n)
+                { out.write(data, n); });
+    out << "\n";
+    return Status::ok;
+}
+
+// Function to set a file's size, zero-filling when it grows
+Status truncate(Session &session, const std::string &path, std::size_t size)
+{
+    WriteHandle handle = find_file<WriteHandle>(session, path, mode_write);
+    if (!handle.file)
+    {
+        return handle.status;
+    }
+    Inode &inode = inodes[handle.file->inode];
+    std::size_t old_size = inode.size;
+    inode_resize(inode, size);
+    if (size > old_size)
+    {
+        inode_spans(inode, old_size, size - old_size, [](char *data, std::size_t n)
+                    { std::memset(data, 0, n); });
+    }
+    return Status::ok;
+}
+
+// Function to print a file's inode information
+Status stat(Session &session, const std::string &path)
+{
+    ReadHandle handle = find_file<ReadHandle>(session, path, 0);
+    if (!handle.file)
+    {
+        return handle.status;
+    }
+    const Inode &inode = inodes[handle.file->inode];
+    Attributes attributes = handle.file->attributes;
+    std::ostream &out = *session.out;
+    char mode[8];
+    std::snprintf(mode, sizeof(mode), "%04o", attributes_mode(attributes));
+    out << "File: " << handle.name << "\n";
+    out << "Mode: " << mode << ", Uid: " << attributes_uid(attributes) << ", Gid: " << attributes_gid(attributes) << "\n";
+    out << "Inode: " << handle.file->inode << ", Size: " << inode.size << ", Blocks: " << inode_blocks(inode)
+        << ", Extents: " << inode.extents.size() << (inode.extents.empty() ? " (inline)" : "") << "\n";
+    for (const Extent &extent : inode.extents)
+    {
+        out << "  blocks " << extent.start << "-" << extent.start + extent.count - 1 << "\n";
+    }
+    return Status::ok;
+}
+
+// Function to change the mode of a file or directory; only its owner or the
+// superuser may do so
+Status chmod(Session &session, unsigned mode, const std::string &path)
+{
+    std::string target = journal_target(session.cwd_path, path);
+    DirectoryRef ref;
+    Attributes attributes;
+    Status status = resolve(session, path, ref, attributes);
+    if (status == Status::denied)
+    {
+        return status;
+    }
+    if (status == Status::ok)
+    {
+        // A directory: its attributes are cached in its parent's dentry
+        Directory &dir = directories[ref.id];
+        std::unique_lock<std::shared_mutex> parent_guard;
+        if (ref.id != root)
+        {
+            parent_guard = std::unique_lock<std::shared_mutex>(directories[dir.parent].lock);
+        }
+        if (!is_current(ref))
+        {
+            return Status::failed;
+        }
+        attributes = dir.attributes.load(std::memory_order_relaxed);
+        if (session.uid != 0 && attributes_uid(attributes) != session.uid)
+        {
+            return Status::denied;
+        }
+        dir.attributes.store(make_attributes(mode, attributes_uid(attributes), attributes_gid(attributes)), std::memory_order_relaxed);
+        if (ref.id != root)
+        {
+            dentry_invalidate(dir.parent, dir.name.view());
+        }
+        record_change(session, JournalOp::chmod, target, mode);
+        return Status::ok;
+    }
+
+    WriteHandle handle = find_file<WriteHandle>(session, path, 0);
+    if (!handle.file)
+    {
+        return handle.status;
+    }
+    attributes = handle.file->attributes;
+    if (session.uid != 0 && attributes_uid(attributes) != session.uid)
+    {
+        return Status::denied;
+    }
+    handle.file->attributes = make_attributes(mode, attributes_uid(attributes), attributes_gid(attributes));
+    dentry_invalidate(handle.parent, handle.name);
+    record_change(session, JournalOp::chmod, target, mode);
+    return Status::ok;
+}
+
+// Function to switch the identity a session acts as; only the superuser
+// may, so a session that has dropped to another user cannot return
+Status su(Session &session, std::uint32_t uid, std::uint32_t gid)
+{
+    if (session.uid != 0)
+    {
+        return Status::denied;
+    }
+    if (uid > max_id || gid > max_id)
+    {
+        return Status::failed;
+    }
+    session.uid = uid;
+    session.gid = gid;
+    return Status::ok;
+}
+
+// Function to split the next whitespace-separated token off the front of line
+std::string_view next_token(std::string_view &line)
+{
+    std::size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos)
+    {
+        line = {};
+        return {};
+    }
+    std::size_t end = std::min(line.find_first_of(" \t\r", begin), line.size());
+    std::string_view token = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return token;
+}
+
+// Function to parse a whole token as a number in the given base
+template <typename T>
+bool parse_number(std::string_view text, T &value, int base = 10)
+{
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+// Function to print the error for a failed command
+void report(std::ostream &out, Status status, const char *failure)
+{
+    if (status == Status::denied)
+    {
+        out << "Error: Permission denied.\n";
+    }
+    else if (status == Status::failed)
+    {
+        out << failure;
+    }
+}
+
+// Function to match one pattern character, ? or [...] class against c and
+// return where the next pattern character starts
+bool glob_char(std::string_view pattern, std::size_t p, char c, std::size_t &next)
+{
+    if (pattern[p] == '?')
+    {
+        next = p + 1;
+        return true;
+    }
+    if (pattern[p] == '[' && p + 1 < pattern.size())
+    {
+        bool negate = pattern[p + 1] == '!';
+        std::size_t q = p + 1 + negate;
+        std::size_t end = pattern.find(']', q + 1);
+        if (end != std::string_view::npos)
+        {
+            bool found = false;
+            for (; q < end; q++)
+            {
+                if (q + 2 < end && pattern[q + 1] == '-')
+                {
+                    found = found || (c >= pattern[q] && c <= pattern[q + 2]);
+                    q += 2;
+                }
+                else
+                {
+                    found = found || c == pattern[q];
+                }
+            }
+            next = end + 1;
+            return found != negate;
+        }
+    }
+    next = p + 1;
+    return pattern[p] == c;
+}
+
+// Function to match a name against a shell glob with *, ? and [...] classes;
+// a * backtracks to the most recent star only, so matching is linear-ish
+bool glob_match(std::string_view pattern, std::string_view name)
+{
+    std::size_t p = 0, n = 0;
+    std::size_t star = std::string_view::npos, resume = 0;
+    while (n < name.size())
+    {
+        std::size_t next;
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            resume = n;
+        }
+        else if (p < pattern.size() && glob_char(pattern, p, name[n], next))
+        {
+            p = next;
+            n++;
+        }
+        else if (star != std::string_view::npos)
+        {
+            p = star + 1;
+            n = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+    {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Function to parse "[path] [--from name] [--prefix p] [--limit N]"
+bool parse_ls(std::string_view arguments, ListQuery &query)
+{
+    std::string_view token = next_token(arguments);
+    if (!token.empty() && token.substr(0, 2) != "--")
+    {
+        query.path = std::string(token);
+        token = next_token(arguments);
+    }
+    for (; !token.empty(); token = next_token(arguments))
+    {
+        std::string_view value = next_token(arguments);
+        if (token == "--from" && !value.empty())
+        {
+            query.from = std::string(value);
+        }
+        else if (token == "--prefix" && !value.empty())
+        {
+            query.prefix = std::string(value);
+        }
+        else if (token != "--limit" || !parse_number(value, query.limit))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Predicates of a find command
+struct FindQuery
+{
+    std::string path = ".";
+    std::string pattern = "*";
+    char type = 0; // 'f', 'd' or 0 for both
+};
+
+// Function to parse "[path] [-name pattern] [-type f|d]"
+bool parse_find(std::string_view arguments, FindQuery &query)
+{
+    std::string_view token = next_token(arguments);
+    if (!token.empty() && token[0] != '-')
+    {
+        query.path = std::string(token);
+        token = next_token(arguments);
+    }
+    for (; !token.empty(); token = next_token(arguments))
+    {
+        std::string_view value = next_token(arguments);
+        if (token == "-name" && !value.empty())
+        {
+            query.pattern = std::string(value);
+        }
+        else if (token == "-type" && (value == "f" || value == "d"))
+        {
+            query.type = value[0];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to print every path under a directory whose name matches the
+// query. Matches stream out as the parallel walk finds them, so their order
+// varies from run to run.
+Status find(Session &session, const FindQuery &query)
+{
+    DirectoryRef ref;
+    Attributes attributes;
+    Status status = resolve(session, query.path, ref, attributes);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+
+    // The starting point is matched by its last component, as in find(1)
+    std::string_view top_name = query.path;
+    while (top_name.size() > 1 && top_name.back() == '/')
+    {
+        top_name.remove_suffix(1);
+    }
+    if (top_name.size() > 1)
+    {
+        top_name = top_name.substr(top_name.rfind('/') + 1);
+    }
+    if (query.type != 'f' && glob_match(query.pattern, top_name))
+    {
+        *session.out << query.path << "\n";
+    }
+
+    OutputSink sink(*session.out);
+    auto visit = [&](const std::string &path, Directory &dir, std::string &out)
+    {
+        for (const DirectoryEntry &entry : dir.entries)
+        {
+            char type = entry.kind == EntryKind::directory ? 'd' : 'f';
+            if ((query.type == 0 || query.type == type) && glob_match(query.pattern, entry.name.view()))
+            {
+                out += join_path(path, entry.name.view());
+                out += '\n';
+                sink.flush_if_full(out);
+            }
+        }
+    };
+    walk(session, ref, attributes, query.path, sink, visit);
+    return Status::ok;
+}
+
+// Function to print the space used by a subtree, summed in parallel
+Status du(Session &session, const std::string &path)
+{
+    DirectoryRef ref;
+    Attributes attributes;
+    Status status = resolve(session, path, ref, attributes);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+
+    std::atomic<std::size_t> bytes{0}, blocks{0}, file_count{0}, directory_count{0};
+    OutputSink sink(*session.out);
+    auto visit = [&](const std::string &, Directory &dir, std::string &)
+    {
+        std::size_t dir_bytes = 0, dir_blocks = 0;
+        for (const DirectoryEntry &entry : dir.entries)
+        {
+            if (entry.kind == EntryKind::file)
+            {
+                const Inode &inode = inodes[entry.file.inode];
+                dir_bytes += inode.size;
+                dir_blocks += inode_blocks(inode);
+            }
+        }
+        bytes.fetch_add(dir_bytes, std::memory_order_relaxed);
+        blocks.fetch_add(dir_blocks, std::memory_order_relaxed);
+        file_count.fetch_add(dir.entries.file_count(), std::memory_order_relaxed);
+        directory_count.fetch_add(1, std::memory_order_relaxed);
+    };
+    walk(session, ref, attributes, path, sink, visit);
+    *session.out << "Size: " << bytes.load() << ", Blocks: " << blocks.load() << ", Files: " << file_count.load()
+                 << ", Directories: " << directory_count.load() << "\n";
+    return Status::ok;
+}
+
+// One directory of a tree listing. Pool tasks fill nodes in parallel; the
+// caller prints them depth-first in order as soon as each one is ready.
+struct TreeNode
 {
-    owner,
-    group,
-    other
+    std::string header;             // the directory's own line
+    std::vector<std::string> files; // file lines before each child, and after the last
+    std::vector<std::unique_ptr<TreeNode>> children;
+    std::atomic<bool> ready{false};
 };
 
-struct Permission
+// Function to print a subtree as an indented listing in name order, as in
+// ls. Subtrees are read in parallel but printed in order, each
+// one as soon as everything before it has been printed.
+Status tree(Session &session, const std::string &path)
 {
-    bool read;
-    bool write;
-    bool execute;
-};
+    DirectoryRef ref;
+    Attributes attributes;
+    Status status = resolve(session, path, ref, attributes);
+    if (status != Status::ok)
+    {
+        return status;
+    }
 
-// Define a structure for File
-struct File
+    WorkPool &pool = work_pool();
+    TaskGroup group;
+    std::atomic<std::size_t> file_count{0}, directory_count{0};
+    std::function<void(TreeNode *, DirectoryRef, Attributes, std::size_t)> render =
+        [&](TreeNode *node, DirectoryRef dir_ref, Attributes dir_attributes, std::size_t depth)
+    {
+        // Children are collected first: once ready is set the printer may
+        // free this node, so it must not be touched afterwards
+        std::vector<std::tuple<TreeNode *, DirectoryRef, Attributes>> pending;
+        if (!permitted(session, dir_attributes, mode_read | mode_execute))
+        {
+            node->header.insert(node->header.size() - 1, " [Permission denied]");
+        }
+        else
+        {
+            ensure_materialized(dir_ref);
+            Directory &dir = directories[dir_ref.id];
+            std::shared_lock<std::shared_mutex> guard(dir.lock);
+            if (is_current(dir_ref))
+            {
+                std::string indent(2 * (depth + 1), ' ');
+                node->files.emplace_back();
+                for (const DirectoryEntry &entry : dir.entries)
+                {
+                    if (entry.kind == EntryKind::directory)
+                    {
+                        auto child = std::make_unique<TreeNode>();
+                        child->header = indent + std::string(entry.name.view()) + "/\n";
+                        pending.emplace_back(child.get(), directory_ref(entry.directory), directories[entry.directory].attributes.load(std::memory_order_relaxed));
+                        node->children.push_back(std::move(child));
+                        node->files.emplace_back();
+                    }
+                    else
+                    {
+                        node->files.back() += indent;
+                        node->files.back() += entry.name.view();
+                        node->files.back() += '\n';
+                    }
+                }
+                directory_count.fetch_add(dir.entries.directory_count(), std::memory_order_relaxed);
+                file_count.fetch_add(dir.entries.file_count(), std::memory_order_relaxed);
+            }
+        }
+        node->ready.store(true, std::memory_order_release);
+        for (const auto &[child, child_ref, child_attributes] : pending)
+        {
+            pool.submit(group, [&render, child = child, child_ref = child_ref, child_attributes = child_attributes, depth]
+                        { render(child, child_ref, child_attributes, depth + 1); });
+        }
+    };
+
+    std::string out;
+    std::function<void(TreeNode &)> print = [&](TreeNode &node)
+    {
+        pool.help_until([&]
+                        { return node.ready.load(std::memory_order_acquire); });
+        out += node.header;
+        for (std::size_t i = 0; i < node.files.size(); i++)
+        {
+            out += node.files[i];
+            if (i < node.children.size())
+            {
+                print(*node.children[i]);
+                node.children[i].reset();
+            }
+        }
+        if (out.size() >= OutputSink::chunk)
+        {
+            session.out->write(out.data(), out.size());
+            out.clear();
+        }
+    };
+
+    TreeNode top;
+    top.header = path + "\n";
+    render(&top, ref, attributes, 0);
+    print(top);
+    pool.wait(group);
+    *session.out << out << "\n"
+                 << directory_count.load() << " directories, " << file_count.load() << " files\n";
+    return Status::ok;
+}
+
+// Function to build the record of a copy: both paths, separated by a '\0'
+std::string copy_record(const Session &session, const std::string &source, const std::string &target)
 {
-    std::string name;
-    std::map<UserClass, Permission> permissions;
-};
+    std::string record = journal_target(session.cwd_path, source);
+    if (!record.empty())
+    {
+        record += '\0';
+        record += journal_target(session.cwd_path, target);
+    }
+    return record;
+}
 
-// Define a structure for Directory
-struct Directory
+// Function to copy one file, replacing the target's content if it exists
+Status copy_file(Session &session, const std::string &source, const std::string &target)
 {
-    std::string name;
-    std::map<std::string, Directory> subdirectories;
-    std::map<std::string, File> files;
-    std::map<UserClass, Permission> permissions;
-};
+    std::string record = copy_record(session, source, target);
+    InodeId copy = new_inode();
+    unsigned mode;
+    {
+        ReadHandle handle = find_file<ReadHandle>(session, source, mode_read);
+        if (!handle.file)
+        {
+            free_inode(copy);
+            return handle.status;
+        }
+        inode_copy(inodes[handle.file->inode], inodes[copy]);
+        mode = attributes_mode(handle.file->attributes);
+    }
 
-// Declare global variables for the current directory and root directory
-Directory current_directory;
-Directory root;
+    DirectoryRef parent;
+    Attributes attributes;
+    std::string_view name;
+    Status status = resolve_parent(session, target, parent, attributes, name);
+    if (status == Status::ok)
+    {
+        ensure_materialized(parent);
+        Directory &dir = directories[parent.id];
+        std::unique_lock<std::shared_mutex> guard(dir.lock);
+        DirectoryEntry *entry = dir.entries.find(name);
+        if (!is_current(parent) || (entry && entry->kind == EntryKind::directory))
+        {
+            status = Status::failed;
+        }
+        else if (entry)
+        {
+            if (permitted(session, entry->file.attributes, mode_write))
+            {
+                std::swap(entry->file.inode, copy);
+                record_change(session, JournalOp::copy_file, record);
+            }
+            else
+            {
+                status = Status::denied;
+            }
+        }
+        else if (permitted(session, attributes, mode_write))
+        {
+            dir.entries.insert(file_entry(EntryName(name), {make_attributes(mode, session.uid, session.gid), copy}));
+            dentry_invalidate(parent.id, name);
+            record_change(session, JournalOp::copy_file, record);
+            return Status::ok;
+        }
+        else
+        {
+            status = Status::denied;
+        }
+    }
+    free_inode(copy);
+    return status;
+}
 
-// Function to print the current directory's content
-void ls()
+// Function to copy a file, or with recursive a whole subtree, to a new path.
+// The copy is built in parallel as a detached subtree, which no other session
+// can reach, so its nodes are filled without locks; it is linked into the
+// target's parent only once complete. Directories that cannot be read are
+// reported and copied empty.
+Status cp(Session &session, const std::string &source, const std::string &target, bool recursive)
 {
-    for (const auto &subdir : current_directory.subdirectories)
+    DirectoryRef from;
+    Attributes from_attributes;
+    Status status = resolve(session, source, from, from_attributes);
+    if (!recursive || status == Status::failed)
+    {
+        return copy_file(session, source, target);
+    }
+    if (status != Status::ok)
+    {
+        return status;
+    }
+
+    DirectoryRef parent;
+    std::string_view name;
+    status = resolve_parent_for_update(session, target, parent, name);
+    if (status != Status::ok)
+    {
+        return status;
+    }
+    std::vector<DirectoryId> ancestors = ancestors_of(parent);
+    if (std::find(ancestors.begin(), ancestors.end(), from.id) != ancestors.end())
     {
-        std::cout << subdir.first << "/\n";
+        return Status::failed; // a directory cannot be copied into itself
     }
-    for (const auto &file : current_directory.files)
+    std::string record = copy_record(session, source, target);
+
+    WorkPool &pool = work_pool();
+    TaskGroup group;
+    OutputSink sink(*session.out);
+    std::atomic<bool> complete{true};
+    std::function<void(DirectoryRef, Attributes, const std::string &, DirectoryRef)> copy_directory =
+        [&](DirectoryRef src_ref, Attributes src_attributes, const std::string &src_path, DirectoryRef dst_ref)
+    {
+        std::string out;
+        if (!permitted(session, src_attributes, mode_read | mode_execute))
+        {
+            out += "Error: Permission denied: " + src_path + "\n";
+            complete.store(false, std::memory_order_relaxed);
+            sink.flush(out);
+            return;
+        }
+
+        ensure_materialized(src_ref);
+        Directory &src = directories[src_ref.id];
+        Directory &dst = directories[dst_ref.id];
+        std::shared_lock<std::shared_mutex> guard(src.lock);
+        if (!is_current(src_ref))
+        {
+            return;
+        }
+        for (const DirectoryEntry &entry : src.entries)
+        {
+            if (entry.kind == EntryKind::directory)
+            {
+                Attributes child_attributes = directories[entry.directory].attributes.load(std::memory_order_relaxed);
+                DirectoryRef child = new_directory(entry.name, dst_ref, make_attributes(attributes_mode(child_attributes), session.uid, session.gid));
+                dst.entries.insert(directory_entry(entry.name, child.id));
+                pool.submit(group, [&copy_directory, src_child = directory_ref(entry.directory), child_attributes, child_path = join_path(src_path, entry.name.view()), child]
+                            { copy_directory(src_child, child_attributes, child_path, child); });
+                continue;
+            }
+            if (!permitted(session, entry.file.attributes, mode_read))
+            {
+                out += "Error: Permission denied: " + join_path(src_path, entry.name.view()) + "\n";
+                complete.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            InodeId copy = new_inode();
+            inode_copy(inodes[entry.file.inode], inodes[copy]);
+            dst.entries.insert(file_entry(entry.name, {make_attributes(attributes_mode(entry.file.attributes), session.uid, session.gid), copy}));
+        }
+        guard.unlock();
+        sink.flush(out);
+    };
+
+    EntryName copy_name(name);
+    DirectoryRef copy = new_directory(copy_name, parent, make_attributes(attributes_mode(from_attributes), session.uid, session.gid));
+    copy_directory(from, from_attributes, source, copy);
+    pool.wait(group);
+
+    Directory &dir = directories[parent.id];
     {
-        std::cout << file.first << "\n";
+        std::unique_lock<std::shared_mutex> guard(dir.lock);
+        if (is_current(parent) && dir.entries.insert(directory_entry(copy_name, copy.id)))
+        {
+            dentry_invalidate(parent.id, name);
+            record_change(session, JournalOp::copy_tree, record);
+            return complete.load() ? Status::ok : Status::denied;
+        }
     }
+    free_directory(copy.id);
+    return Status::failed;
 }
 
-// Function to print the working directory
-void pwd(const Directory &dir, const std::string &path)
+// Function to remove a file, or a directory together with everything below it
+Status rm_recursive(Session &session, const std::string &path)
 {
-    if (dir.name == current_directory.name)
+    DirectoryRef parent, target;
+    Attributes attributes;
+    std::string_view name;
+    Status status = resolve_parent(session, path, parent, attributes, name);
+    if (status != Status::ok)
     {
-        std::cout << path << "\n";
-        return;
+        return status;
+    }
+    switch (lookup(parent, name, target, attributes))
+    {
+    case EntryKind::directory:
+        return remove_directory(session, path, true);
+    case EntryKind::file:
+        return rm(session, path);
+    default:
+        return Status::failed;
     }
+}
 
-    for (const auto &subdir : dir.subdirectories)
+// Function to redo one journaled change with the identity that made it.
+// Permission checks pass or fail exactly as they did the first time, since
+// the tree is in the same state.
+void journal_replay(const JournalRecord &record, std::string_view path)
+{
+    std::ostream discard(nullptr);
+    Session session = new_session(discard, record.uid, record.gid);
+    std::string target(path.substr(0, path.find('\0')));
+    switch (record.op)
     {
-        pwd(subdir.second, path + "/" + subdir.first);
+    case JournalOp::mkdir:
+        mkdir(session, target);
+        break;
+    case JournalOp::rmdir:
+        rmdir(session, target);
+        break;
+    case JournalOp::remove_tree:
+        rm_recursive(session, target);
+        break;
+    case JournalOp::create:
+        touch(session, target);
+        break;
+    case JournalOp::unlink:
+        rm(session, target);
+        break;
+    case JournalOp::chmod:
+        chmod(session, record.mode, target);
+        break;
+    case JournalOp::copy_file:
+    case JournalOp::copy_tree:
+        if (target.size() < path.size())
+        {
+            cp(session, target, std::string(path.substr(target.size() + 1)), record.op == JournalOp::copy_tree);
+        }
+        break;
     }
 }
 
-// Function to change directory
-bool cd(const std::string &dir_name)
+// Function to replay the journal of a freshly loaded image and reopen it for
+// appending. Reading stops at the first record that is cut short or fails its
+// checksum, and the file is cut back to that point. A journal written for a
+// different checkpoint is left over from before the last save and discarded.
+bool journal_recover(const std::string &image_path)
 {
-    if (dir_name == "..")
+    std::ifstream in(journal_path(image_path), std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const std::size_t header_size = sizeof(journal_magic) + sizeof(std::uint64_t);
+    std::uint64_t checkpoint = 0;
+    if (data.size() >= header_size)
+    {
+        std::memcpy(&checkpoint, data.data() + sizeof(journal_magic), sizeof(checkpoint));
+    }
+    if (data.size() < header_size || std::memcmp(data.data(), journal_magic, sizeof(journal_magic)) != 0 || checkpoint != image_checkpoint)
     {
-        if (current_directory.name != root.name)
+        return journal_open(image_path, 0);
+    }
+
+    std::size_t offset = header_size;
+    std::uint64_t replayed = 0;
+    while (data.size() - offset >= sizeof(JournalRecord))
+    {
+        JournalRecord record;
+        std::memcpy(&record, data.data() + offset, sizeof(record));
+        if (record.length > data.size() - offset - sizeof(record))
         {
-            pwd(root, "/");
-            return true;
+            break;
         }
-        else
+        const char *body = data.data() + offset + offsetof(JournalRecord, op);
+        std::string_view path(data.data() + offset + sizeof(record), record.length);
+        if (crc32(crc32(0, body, sizeof(record) - offsetof(JournalRecord, op)), path.data(), path.size()) != record.checksum)
         {
-            return false;
+            break;
         }
+        journal_replay(record, path);
+        offset += sizeof(record) + record.length;
+        replayed++;
     }
-    else if (current_directory.subdirectories.count(dir_name))
+
+    if (!journal_open(image_path, offset))
     {
-        current_directory = current_directory.subdirectories[dir_name];
-        return true;
+        return false;
     }
-
-    return false;
+    journal.replayed = replayed;
+    return true;
 }
 
-// Function to create a new directory
-void mkdir(const std::string &dir_name)
+// Function to print how well group commit is batching records
+void print_journal_stats(std::ostream &out)
 {
-    Permission default_permission = {true, true, true};
-    current_directory.subdirectories[dir_name] = {dir_name, {}, {}, {{UserClass::owner, default_permission}, {UserClass::group, default_permission}, {UserClass::other, default_permission}}};
+    if (!journal_active.load())
+    {
+        out << "Journal: off\n";
+        return;
+    }
+    std::lock_guard<std::mutex> guard(journal.mutex);
+    out << "Journal: " << journal_path(journal.image) << ", Bytes: " << journal.bytes << ", Replayed: " << journal.replayed
+        << ", Records: " << journal.records << ", Flushes: " << journal.flushes
+        << ", Records/flush: " << (journal.flushes ? static_cast<double>(journal.records) / journal.flushes : 0) << "\n";
 }
 
-// Function to remove a directory
-void rmdir(const std::string &dir_name)
+// Function to print the memory the tree takes, by structure and per node.
+// Directories not yet read from the image count only as their own node.
+void print_memory(std::ostream &out)
 {
-    current_directory.subdirectories.erase(dir_name);
+    std::size_t directory_count = 0, file_count = 0, index_bytes = 0, extent_bytes = 0;
+    for (DirectoryId id = 0; id < directories.size(); id++)
+    {
+        Directory &dir = directories[id];
+        std::shared_lock<std::shared_mutex> guard(dir.lock);
+        if (dir.name.view().empty())
+        {
+            continue; // a freed slot
+        }
+        directory_count++;
+        file_count += dir.entries.file_count();
+        index_bytes += dir.entries.memory();
+        for (const DirectoryEntry &entry : dir.entries)
+        {
+            if (entry.kind == EntryKind::file)
+            {
+                extent_bytes += inodes[entry.file.inode].extents.capacity() * sizeof(Extent);
+            }
+        }
+    }
+    std::size_t name_count, name_bytes;
+    names.usage(name_count, name_bytes);
+    std::size_t directory_bytes = directories.size() * sizeof(Directory);
+    std::size_t inode_bytes = inodes.size() * sizeof(Inode);
+    std::size_t total = directory_bytes + inode_bytes + index_bytes + extent_bytes + name_bytes;
+    std::size_t node_count = directory_count + file_count;
+
+    out << "Directories: " << directory_count << ", Files: " << file_count << ", Names: " << name_count << "\n"
+        << "Directory nodes: " << directory_bytes << " B, Inodes: " << inode_bytes << " B, Indexes: " << index_bytes
+        << " B, Extents: " << extent_bytes << " B, Names: " << name_bytes << " B\n"
+        << "Total: " << total << " B, Per node: " << (node_count ? total / node_count : 0) << " B\n";
 }
 
-// Function to create a new file
-void touch(const std::string &file_name)
+// Function to run one command line in a session; returns false on exit
+bool run_command(Session &session, std::string_view command)
 {
-    Permission default_permission = {true, true, false};
-    current_directory.files[file_name] = {file_name, {{UserClass::owner, default_permission}, {UserClass::group, default_permission}, {UserClass::other, default_permission}}};
+    // Reused between calls so steady-state parsing does not allocate
+    thread_local std::string operation, arg;
+    std::ostream &out = *session.out;
+
+    operation = next_token(command);
+    std::string_view arguments = command;
+    arg = next_token(command);
+
+    // write/append take the rest of the line as the data
+    std::size_t data_begin = command.find_first_not_of(" \t");
+    std::string_view data = data_begin == std::string_view::npos ? std::string_view() : command.substr(data_begin);
+    if (!data.empty() && data.back() == '\r')
+    {
+        data.remove_suffix(1);
+    }
+
+    if ((operation == "mkdir" || operation == "rmdir" || operation == "touch" || operation == "rm" || operation == "cp" ||
+         operation == "chmod" || operation == "write" || operation == "append") &&
+        journal_active.load() && journal_failed())
+    {
+        // The change could not be journaled after the records lost
+        out << "Error: Journal failed; checkpoint or save the tree.\n";
+    }
+    else if (operation == "ls")
+    {
+        ListQuery query;
+        report(out, parse_ls(arguments, query) ? ls(session, query) : Status::failed, "Error: Directory not found.\n");
+    }
+    else if (operation == "pwd")
+    {
+        report(out, pwd(session), "Error: Directory not found.\n");
+    }
+    else if (operation == "cd")
+    {
+        report(out, cd(session, arg), "Error: Directory not found.\n");
+    }
+    else if (operation == "mkdir")
+    {
+        report(out, mkdir(session, arg), "Error: Cannot create directory.\n");
+    }
+    else if (operation == "rmdir")
+    {
+        report(out, rmdir(session, arg), "Error: Cannot remove directory.\n");
+    }
+    else if (operation == "touch")
+    {
+        report(out, touch(session, arg), "Error: Cannot create file.\n");
+    }
+    else if (operation == "rm")
+    {
+        if (arg == "-r")
+        {
+            report(out, rm_recursive(session, std::string(next_token(data))), "Error: Cannot remove.\n");
+        }
+        else
+        {
+            report(out, rm(session, arg), "Error: File not found.\n");
+        }
+    }
+    else if (operation == "cp")
+    {
+        bool recursive = arg == "-r";
+        std::string_view rest = data;
+        std::string source(recursive ? next_token(rest) : std::string_view(arg));
+        std::string target(next_token(rest));
+        report(out, cp(session, source, target, recursive), "Error: Cannot copy.\n");
+    }
+    else if (operation == "find")
+    {
+        FindQuery query;
+        report(out, parse_find(arguments, query) ? find(session, query) : Status::failed, "Error: Cannot search directory.\n");
+    }
+    else if (operation == "du")
+    {
+        report(out, du(session, arg.empty() ? "." : arg), "Error: Directory not found.\n");
+    }
+    else if (operation == "tree")
+    {
+        report(out, tree(session, arg.empty() ? "." : arg), "Error: Directory not found.\n");
+    }
+    else if (operation == "write")
+    {
+        report(out, write(session, arg, data), "Error: Cannot write file.\n");
+    }
+    else if (operation == "append")
+    {
+        report(out, append(session, arg, data), "Error: Cannot write file.\n");
+    }
+    else if (operation == "cat")
+    {
+        report(out, cat(session, arg), "Error: File not found.\n");
+    }
+    else if (operation == "truncate")
+    {
+        std::size_t size;
+        report(out, parse_number(data, size) ? truncate(session, arg, size) : Status::failed, "Error: Cannot truncate file.\n");
+    }
+    else if (operation == "stat")
+    {
+        report(out, stat(session, arg), "Error: File not found.\n");
+    }
+    else if (operation == "chmod")
+    {
+        unsigned mode;
+        report(out, parse_number(arg, mode, 8) && mode <= 0777 ? chmod(session, mode, std::string(data)) : Status::failed, "Error: Cannot change mode.\n");
+    }
+    else if (operation == "su")
+    {
+        std::uint32_t uid, gid = 0;
+        report(out, parse_number(arg, uid) && (data.empty() || parse_number(data, gid)) ? su(session, uid, gid) : Status::failed, "Error: Invalid user.\n");
+    }
+    else if (operation == "id")
+    {
+        out << "uid=" << session.uid << " gid=" << session.gid << "\n";
+    }
+    else if ((operation == "save" || operation == "load" || operation == "checkpoint") && session.uid != 0)
+    {
+        // Images hold and replace the whole tree, so only the superuser
+        // may write or read them
+        report(out, Status::denied, "");
+    }
+    else if (operation == "save")
+    {
+        if (!save(arg))
+        {
+            out << "Error: Cannot save image.\n";
+        }
+    }
+    else if (operation == "load")
+    {
+        if (!load(arg))
+        {
+            out << "Error: Cannot load image.\n";
+        }
+        else
+        {
+            session.cwd = directory_ref(root);
+            session.cwd_path = "/";
+            session.lsn = 0;
+        }
+    }
+    else if (operation == "checkpoint")
+    {
+        // A failed journal is superseded by the new image
+        if (!journal_active.load() || (!journal_commit(session.lsn) && !journal_failed()) || !save(journal.image))
+        {
+            out << "Error: Cannot checkpoint.\n";
+        }
+    }
+    else if (operation == "sync")
+    {
+        if (!journal_commit(session.lsn))
+        {
+            out << "Error: Cannot write journal.\n";
+        }
+    }
+    else if (operation == "journal")
+    {
+        print_journal_stats(out);
+    }
+    else if (operation == "memory")
+    {
+        print_memory(out);
+    }
+    else if (operation == "exit")
+    {
+        return false;
+    }
+    else if (!operation.empty())
+    {
+        out << "Error: Invalid command.\n";
+    }
+    return true;
 }
 
-// Function to remove a file
-void rm(const std::string &file_name)
+// Function to run commands from a script or pipe without prompts, with
+// buffered output, and report throughput and latency percentiles on stderr
+void run_batch(Session &session, std::istream &in)
 {
-    current_directory.files.erase(file_name);
+    using clock = std::chrono::steady_clock;
+    std::vector<std::uint64_t> latencies; // nanoseconds per command
+    std::string command;
+
+    clock::time_point start = clock::now();
+    while (std::getline(in, command))
+    {
+        clock::time_point before = clock::now();
+        bool keep_going = run_command(session, command);
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - before).count());
+        if (!keep_going)
+        {
+            break;
+        }
+    }
+    // The whole batch shares one journal sync rather than one per command
+    if (!journal_commit(session.lsn))
+    {
+        *session.out << "Error: Cannot write journal.\n";
+    }
+    session.out->flush();
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::size_t n = latencies.size();
+    std::cerr << "Commands: " << n << ", Time: " << seconds << " s, Commands/s: " << (seconds > 0 ? n / seconds : 0) << "\n";
+    if (n == 0)
+    {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p)
+    { return latencies[std::min(n - 1, static_cast<std::size_t>(p / 100.0 * n))]; };
+    std::cerr << "Latency (ns): p50 " << percentile(50) << ", p90 " << percentile(90) << ", p99 " << percentile(99)
+              << ", p99.9 " << percentile(99.9) << ", max " << latencies.back() << "\n";
 }
 
-int main()
+// Function to hammer one shared tree from 1, 2, 4, ... threads, each with its
+// own session, and print throughput per thread count. The mix is mostly
+// lookups across the whole tree (ls, stat, cat, cd/pwd) plus creates and
+// removes inside each thread's own directory. With an image loaded, those
+// changes are journaled and every operation waits for its commit.
+void stress(double seconds_per_run)
 {
-    root = {"root"};
-    current_directory = root;
+    const int top_directories = 64;
+    const int entries_per_directory = 16;
+    std::ostream discard(nullptr);
 
-    std::string command;
-    while (true)
+    Session setup = new_session(discard);
+    for (int i = 0; i < top_directories; i++)
     {
-        std::cout << "> ";
-        std::getline(std::cin, command);
+        std::string top = "/s" + std::to_string(i);
+        mkdir(setup, top);
+        for (int j = 0; j < entries_per_directory; j++)
+        {
+            mkdir(setup, top + "/d" + std::to_string(j));
+            write(setup, top + "/f" + std::to_string(j), "stress");
+        }
+    }
 
-        std::istringstream iss(command);
-        std::string operation;
-        std::string arg;
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    double base_rate = 0;
+    std::cout << "threads, ops/s, speedup\n";
+    for (unsigned threads = 1;; threads = std::min(threads * 2, max_threads))
+    {
+        std::atomic<bool> stop{false};
+        std::vector<std::uint64_t> counts(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]
+                                 {
+                std::mt19937 rng(t);
+                Session session = new_session(discard);
+                std::string home = "/s" + std::to_string(t % top_directories);
+                cd(session, home);
+                std::string scratch = "t" + std::to_string(t);
+                std::uint64_t ops = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    std::string other = "/s" + std::to_string(rng() % top_directories);
+                    std::string entry = std::to_string(rng() % entries_per_directory);
+                    switch (rng() % 8)
+                    {
+                    case 0:
+                    case 1:
+                        stat(session, other + "/f" + entry);
+                        break;
+                    case 2:
+                        cat(session, other + "/f" + entry);
+                        break;
+                    case 3:
+                    {
+                        ListQuery query;
+                        query.path = other + "/d" + entry;
+                        ls(session, query);
+                        break;
+                    }
+                    case 4:
+                        cd(session, other + "/d" + entry);
+                        pwd(session);
+                        cd(session, home);
+                        break;
+                    case 5:
+                        touch(session, scratch);
+                        rm(session, scratch);
+                        break;
+                    case 6:
+                        mkdir(session, scratch);
+                        rmdir(session, scratch);
+                        break;
+                    default:
+                        ls(session, ListQuery());
+                        break;
+                    }
+                    journal_commit(session.lsn);
+                    ops++;
+                }
+                counts[t] = ops; });
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds_per_run));
+        stop = true;
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
 
-        iss >> operation >> arg;
+        std::uint64_t total = 0;
+        for (std::uint64_t count : counts)
+        {
+            total += count;
+        }
+        double rate = total / seconds_per_run;
+        if (threads == 1)
+        {
+            base_rate = rate;
+        }
+        std::cout << threads << ", " << static_cast<std::uint64_t>(rate) << ", " << rate / base_rate << "\n";
+        if (threads == max_threads)
+        {
+            break;
+        }
+    }
+    if (journal_active.load())
+    {
+        print_journal_stats(std::cout);
+    }
+}
 
-        if (operation == "ls")
+// Usage: FS [--batch] [--script file] [--stress [seconds]] [image]
+//   --batch          read commands from stdin without prompts and print
+//                    throughput statistics at the end
+//   --script file    same, reading commands from file
+//   --stress         run the multithreaded benchmark, seconds per thread count
+//   image            filesystem image to map at startup
+int main(int argc, char *argv[])
+{
+    bool batch = false;
+    double stress_seconds = 0;
+    std::string script, image;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--batch")
         {
-            ls();
+            batch = true;
         }
-        else if (operation == "pwd")
+        else if (option == "--script" && i + 1 < argc)
         {
-            pwd(root, "/");
+            batch = true;
+            script = argv[++i];
         }
-        else if (operation == "cd")
+        else if (option == "--stress")
         {
-            if (!cd(arg))
+            stress_seconds = 1;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
             {
-                std::cout << "Error: Directory not found.\n";
+                stress_seconds = std::atof(argv[++i]);
             }
         }
-        else if (operation == "mkdir")
+        else
         {
-            mkdir(arg);
+            image = option;
         }
-        else if (operation == "rmdir")
+    }
+
+    // An image given on the command line is mapped instead of starting empty
+    if (!image.empty())
+    {
+        if (!load(image))
         {
-            rmdir(arg);
+            std::cerr << "Error: Cannot load image " << image << ".\n";
+            return 1;
         }
-        else if (operation == "touch")
+    }
+    else
+    {
+        format();
+    }
+
+    if (stress_seconds > 0)
+    {
+        stress(stress_seconds);
+        return 0;
+    }
+
+    Session session = new_session(std::cout);
+    if (batch)
+    {
+        static char output_buffer[1 << 20];
+        std::ios::sync_with_stdio(false);
+        std::cin.tie(nullptr);
+        std::cout.rdbuf()->pubsetbuf(output_buffer, sizeof(output_buffer));
+
+        if (script.empty())
         {
-            touch(arg);
+            run_batch(session, std::cin);
         }
-        else if (operation == "rm")
+        else
         {
-            rm(arg);
+            std::ifstream in(script);
+            if (!in)
+            {
+                std::cerr << "Error: Cannot open script " << script << ".\n";
+                return 1;
+            }
+            run_batch(session, in);
         }
-        else if (operation == "exit")
+        return 0;
+    }
+
+    std::string command;
+    while (true)
+    {
+        std::cout << "> ";
+        if (!std::getline(std::cin, command))
         {
             break;
         }
-        else
+        bool keep_going = run_command(session, command);
+        if (!journal_commit(session.lsn))
         {
-            std::cout << "Error: Invalid command.\n";
+            std::cout << "Error: Cannot write journal.\n";
+        }
+        if (!keep_going)
+        {
+            break;
         }
     }
     return 0;
-}
\ No newline at end of file
+}
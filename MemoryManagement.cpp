@@ -1,8 +1,33 @@
 #include <iostream>
 #include <vector>
-#include <queue>
+#include <set>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <charconv>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <climits>
+#include <cstdint>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
 #include <ctime>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 const int MEMORY_SIZE = 102400;
 const int MIN_REQUEST_SIZE = 2;
@@ -15,114 +40,3135 @@ struct Request
     int persistence;
 };
 
-class MemoryManager
+// Interface for a strategy that hands out a fixed amount of memory to
+// requests, identified by their ids
+class Allocator
+{
+public:
+    virtual ~Allocator() {}
+
+    virtual std::string name() const = 0;
+
+    // Place size bytes for a request; false when they do not fit
+    virtual bool allocate(int id, int size) = 0;
+
+    virtual void release(int id) = 0;
+
+    // Bytes given to requests, including what rounding added to them
+    virtual long long reservedBytes() const = 0;
+
+    // Bytes not given to any request
+    virtual long long freeBytes() const = 0;
+
+    // Free bytes in pieces that could each take a request of size bytes,
+    // counting such pieces whole
+    virtual long long usableFree(long long size) const = 0;
+};
+
+// Fixed-size paging: a request gets whole pages, wherever they are free.
+// Free pages are tracked as set bits, 64 to a word, so allocation finds
+// them a word at a time instead of testing every page.
+class PagingAllocator : public Allocator
 {
     int pageSize;
     int numPages;
     std::vector<int> pageTable;
-    std::queue<Request> activeRequests;
+    std::vector<std::uint64_t> freeBitmap;
+    int freePages;
+    std::size_t firstFreeWord; // no word before this one has a free page
+    std::unordered_map<int, std::vector<int>> requestPages;
 
 public:
-    MemoryManager(int pageSize) : pageSize(pageSize)
+    PagingAllocator(int pageSize, long long memorySize) : pageSize(pageSize)
     {
-        numPages = MEMORY_SIZE / pageSize;
+        numPages = static_cast<int>(memorySize / pageSize);
         pageTable.resize(numPages, -1);
+
+        freeBitmap.assign((numPages + 63) / 64, ~std::uint64_t(0));
+        if (numPages % 64 != 0)
+        {
+            freeBitmap.back() = (std::uint64_t(1) << (numPages % 64)) - 1;
+        }
+        freePages = numPages;
+        firstFreeWord = 0;
     }
 
-    bool allocateMemory(Request request)
+    std::string name() const override
+    {
+        return "paging (" + std::to_string(pageSize) + " B pages)";
+    }
+
+    // Allocation takes the lowest-numbered free pages, and costs time in
+    // proportion to the pages needed and the full words skipped over
+    bool allocate(int id, int size) override
     {
-        int pagesNeeded = (request.size + pageSize - 1) / pageSize;
+        int pagesNeeded = (size + pageSize - 1) / pageSize;
+
+        if (freePages < pagesNeeded)
+        {
+            return false;
+        }
 
-        int freePages = 0;
-        for (int i = 0; i < numPages; i++)
+        std::vector<int> &pages = requestPages[id];
+        pages.reserve(pagesNeeded);
+        std::size_t word = firstFreeWord;
+        while (static_cast<int>(pages.size()) < pagesNeeded)
         {
-            if (pageTable[i] == -1)
+            while (freeBitmap[word] == 0)
+            {
+                word++;
+            }
+            // Take free pages from this word, lowest first
+            while (freeBitmap[word] != 0 && static_cast<int>(pages.size()) < pagesNeeded)
             {
-                freePages++;
+                int page = static_cast<int>(word * 64) + __builtin_ctzll(freeBitmap[word]);
+                freeBitmap[word] &= freeBitmap[word] - 1;
+                pageTable[page] = id;
+                pages.push_back(page);
             }
         }
+        freePages -= pagesNeeded;
+        firstFreeWord = word;
+        return true;
+    }
 
-        if (freePages < pagesNeeded)
+    // Releasing a request frees only the pages on its list
+    void release(int id) override
+    {
+        auto it = requestPages.find(id);
+        if (it == requestPages.end())
+        {
+            return;
+        }
+        for (int page : it->second)
+        {
+            pageTable[page] = -1;
+            freeBitmap[page / 64] |= std::uint64_t(1) << (page % 64);
+            if (static_cast<std::size_t>(page / 64) < firstFreeWord)
+            {
+                firstFreeWord = page / 64;
+            }
+        }
+        freePages += it->second.size();
+        requestPages.erase(it);
+    }
+
+    long long reservedBytes() const override
+    {
+        return static_cast<long long>(numPages - freePages) * pageSize;
+    }
+
+    long long freeBytes() const override
+    {
+        return static_cast<long long>(freePages) * pageSize;
+    }
+
+    // Pages need not be contiguous, so the free pages form one piece
+    long long usableFree(long long size) const override
+    {
+        return static_cast<long long>(freePages) * pageSize >= size ? freeBytes() : 0;
+    }
+};
+
+// Binary buddy allocation: blocks are powers of two, split in half to fit
+// a request and merged with their buddy when both halves are free again.
+// Each order keeps its free blocks in address order, so a split or merge
+// costs O(log n) per level.
+class BuddyAllocator : public Allocator
+{
+    static const int minOrder = 4; // 16-byte blocks
+    int maxOrder;
+    std::vector<std::set<long long>> freeLists; // free block offsets, by order
+    std::unordered_map<int, std::pair<long long, int>> placement; // offset and order
+    long long reserved = 0;
+    long long free = 0;
+
+    static int orderFor(long long size)
+    {
+        int order = minOrder;
+        while ((1LL << order) < size)
+        {
+            order++;
+        }
+        return order;
+    }
+
+public:
+    BuddyAllocator(long long memorySize)
+    {
+        maxOrder = minOrder;
+        while ((2LL << maxOrder) <= memorySize)
+        {
+            maxOrder++;
+        }
+        freeLists.resize(maxOrder + 1);
+
+        // Cover memory with the largest aligned blocks that fit; a size
+        // that is not a power of two leaves a few smaller blocks at the end
+        long long offset = 0;
+        for (int order = maxOrder; order >= minOrder; order--)
+        {
+            if (offset + (1LL << order) <= memorySize)
+            {
+                freeLists[order].insert(offset);
+                offset += 1LL << order;
+            }
+        }
+        free = offset;
+    }
+
+    std::string name() const override
+    {
+        return "buddy";
+    }
+
+    bool allocate(int id, int size) override
+    {
+        int order = orderFor(size);
+        int from = order;
+        while (from <= maxOrder && freeLists[from].empty())
+        {
+            from++;
+        }
+        if (from > maxOrder)
+        {
+            return false;
+        }
+
+        long long offset = *freeLists[from].begin();
+        freeLists[from].erase(freeLists[from].begin());
+        // Split, keeping the lower half, until the block is the right size
+        while (from > order)
+        {
+            from--;
+            freeLists[from].insert(offset + (1LL << from));
+        }
+        placement[id] = {offset, order};
+        reserved += 1LL << order;
+        free -= 1LL << order;
+        return true;
+    }
+
+    void release(int id) override
+    {
+        auto it = placement.find(id);
+        if (it == placement.end())
+        {
+            return;
+        }
+        long long offset = it->second.first;
+        int order = it->second.second;
+        placement.erase(it);
+        reserved -= 1LL << order;
+        free += 1LL << order;
+
+        // Merge with the buddy for as long as it is free
+        while (order < maxOrder)
+        {
+            auto buddy = freeLists[order].find(offset ^ (1LL << order));
+            if (buddy == freeLists[order].end())
+            {
+                break;
+            }
+            freeLists[order].erase(buddy);
+            offset &= ~(1LL << order);
+            order++;
+        }
+        freeLists[order].insert(offset);
+    }
+
+    long long reservedBytes() const override
+    {
+        return reserved;
+    }
+
+    long long freeBytes() const override
+    {
+        return free;
+    }
+
+    // Blocks of the order a request of size takes, or larger ones to split
+    long long usableFree(long long size) const override
+    {
+        long long usable = 0;
+        for (int order = orderFor(size); order <= maxOrder; order++)
+        {
+            usable += static_cast<long long>(freeLists[order].size()) << order;
+        }
+        return usable;
+    }
+};
+
+// Slab caches: memory is cut into slabs, each given to one size class on
+// demand and divided into equal slots. A request takes a slot of the
+// smallest class it fits; a slab whose slots are all free again goes back
+// to the pool for any class.
+class SlabAllocator : public Allocator
+{
+    static const int slabSize = 4096;
+
+    struct Slab
+    {
+        int sizeClass = -1;
+        int used = 0;
+        std::vector<int> freeSlots; // lowest slot last
+    };
+
+    std::vector<int> classSizes;
+    std::vector<Slab> slabs;
+    std::set<int> emptySlabs;
+    std::vector<std::set<int>> partialSlabs; // slabs with a free slot, by class
+    std::unordered_map<int, std::pair<int, int>> placement; // slab and slot
+    long long memory;
+    long long reserved = 0;
+
+public:
+    SlabAllocator(long long memorySize) : memory(memorySize)
+    {
+        // Classes at powers of two and halfway between, from 16 bytes to a slab
+        for (int size = 16; size <= slabSize; size *= 2)
+        {
+            classSizes.push_back(size);
+            if (size + size / 2 <= slabSize)
+            {
+                classSizes.push_back(size + size / 2);
+            }
+        }
+        partialSlabs.resize(classSizes.size());
+        slabs.resize(memorySize / slabSize);
+        for (int s = 0; s < static_cast<int>(slabs.size()); s++)
+        {
+            emptySlabs.insert(s);
+        }
+    }
+
+    std::string name() const override
+    {
+        return "slab";
+    }
+
+    bool allocate(int id, int size) override
+    {
+        int sizeClass = 0;
+        while (sizeClass < static_cast<int>(classSizes.size()) && classSizes[sizeClass] < size)
+        {
+            sizeClass++;
+        }
+        if (sizeClass == static_cast<int>(classSizes.size()))
         {
             return false;
         }
 
-        int allocatedPages = 0;
-        for (int i = 0; i < numPages && allocatedPages < pagesNeeded; i++)
+        if (partialSlabs[sizeClass].empty())
         {
-            if (pageTable[i] == -1)
+            if (emptySlabs.empty())
+            {
+                return false;
+            }
+            int s = *emptySlabs.begin();
+            emptySlabs.erase(emptySlabs.begin());
+            Slab &slab = slabs[s];
+            slab.sizeClass = sizeClass;
+            for (int slot = slabSize / classSizes[sizeClass] - 1; slot >= 0; slot--)
             {
-                pageTable[i] = request.id;
-                allocatedPages++;
+                slab.freeSlots.push_back(slot);
             }
+            partialSlabs[sizeClass].insert(s);
         }
 
-        activeRequests.push(request);
+        int s = *partialSlabs[sizeClass].begin();
+        Slab &slab = slabs[s];
+        placement[id] = {s, slab.freeSlots.back()};
+        slab.freeSlots.pop_back();
+        slab.used++;
+        if (slab.freeSlots.empty())
+        {
+            partialSlabs[sizeClass].erase(s);
+        }
+        reserved += classSizes[sizeClass];
         return true;
     }
 
-    void releaseMemory()
+    void release(int id) override
     {
-        while (!activeRequests.empty() && activeRequests.front().persistence <= 0)
+        auto it = placement.find(id);
+        if (it == placement.end())
         {
-            Request request = activeRequests.front();
-            activeRequests.pop();
+            return;
+        }
+        int s = it->second.first;
+        Slab &slab = slabs[s];
+        slab.freeSlots.push_back(it->second.second);
+        placement.erase(it);
+        slab.used--;
+        reserved -= classSizes[slab.sizeClass];
+
+        if (slab.used == 0)
+        {
+            partialSlabs[slab.sizeClass].erase(s);
+            slab.sizeClass = -1;
+            slab.freeSlots.clear();
+            emptySlabs.insert(s);
+        }
+        else
+        {
+            partialSlabs[slab.sizeClass].insert(s);
+        }
+    }
+
+    long long reservedBytes() const override
+    {
+        return reserved;
+    }
+
+    long long freeBytes() const override
+    {
+        return memory - reserved;
+    }
+
+    // A free slot only serves its own class, so a request can use the
+    // empty slabs and the free slots of the class it would take
+    long long usableFree(long long size) const override
+    {
+        int sizeClass = 0;
+        while (sizeClass < static_cast<int>(classSizes.size()) && classSizes[sizeClass] < size)
+        {
+            sizeClass++;
+        }
+        if (sizeClass == static_cast<int>(classSizes.size()))
+        {
+            return 0;
+        }
+        long long usable = static_cast<long long>(emptySlabs.size()) * slabSize;
+        for (int s : partialSlabs[sizeClass])
+        {
+            usable += static_cast<long long>(slabs[s].freeSlots.size()) * classSizes[sizeClass];
+        }
+        return usable;
+    }
+};
+
+// Variable-size blocks on segregated free lists: free blocks are binned by
+// the power of two below their size, split to fit a request and merged with
+// free neighbours on release. First fit takes the lowest-addressed block
+// that fits from the first bin that has one; best fit takes the smallest.
+class SegregatedFitAllocator : public Allocator
+{
+    static const int alignment = 16;
+    bool bestFit;
+    std::map<long long, long long> freeBlocks; // offset to size
+    // Free blocks by bin, keyed by (size, offset) for best fit and by
+    // (offset, size) for first fit
+    std::vector<std::set<std::pair<long long, long long>>> bins;
+    std::unordered_map<int, std::pair<long long, long long>> placement; // offset and size
+    long long reserved = 0;
+    long long free = 0;
+
+    static int binFor(long long size)
+    {
+        return 63 - __builtin_clzll(size);
+    }
+
+    std::pair<long long, long long> key(long long offset, long long size) const
+    {
+        return bestFit ? std::make_pair(size, offset) : std::make_pair(offset, size);
+    }
+
+    void insertFree(long long offset, long long size)
+    {
+        freeBlocks[offset] = size;
+        bins[binFor(size)].insert(key(offset, size));
+        free += size;
+    }
+
+    void eraseFree(long long offset, long long size)
+    {
+        freeBlocks.erase(offset);
+        bins[binFor(size)].erase(key(offset, size));
+        free -= size;
+    }
+
+public:
+    SegregatedFitAllocator(long long memorySize, bool bestFit) : bestFit(bestFit), bins(64)
+    {
+        insertFree(0, memorySize / alignment * alignment);
+    }
+
+    std::string name() const override
+    {
+        return bestFit ? "segregated best fit" : "segregated first fit";
+    }
 
-            for (int i = 0; i < numPages; i++)
+    bool allocate(int id, int size) override
+    {
+        long long need = (static_cast<long long>(size) + alignment - 1) / alignment * alignment;
+        long long offset = -1, blockSize = 0;
+        for (int bin = binFor(need); bin < static_cast<int>(bins.size()) && offset < 0; bin++)
+        {
+            for (auto it = bestFit && bin == binFor(need) ? bins[bin].lower_bound({need, LLONG_MIN}) : bins[bin].begin();
+                 it != bins[bin].end(); ++it)
             {
-                if (pageTable[i] == request.id)
+                long long candidateOffset = bestFit ? it->second : it->first;
+                long long candidateSize = bestFit ? it->first : it->second;
+                if (candidateSize >= need)
                 {
-                    pageTable[i] = -1;
+                    offset = candidateOffset;
+                    blockSize = candidateSize;
+                    break;
                 }
             }
         }
+        if (offset < 0)
+        {
+            return false;
+        }
+
+        eraseFree(offset, blockSize);
+        if (blockSize > need)
+        {
+            insertFree(offset + need, blockSize - need);
+        }
+        placement[id] = {offset, need};
+        reserved += need;
+        return true;
     }
 
-    void decrementPersistence()
+    void release(int id) override
+    {
+        auto it = placement.find(id);
+        if (it == placement.end())
+        {
+            return;
+        }
+        long long offset = it->second.first, size = it->second.second;
+        placement.erase(it);
+        reserved -= size;
+
+        // Merge with the free blocks on either side
+        auto next = freeBlocks.find(offset + size);
+        if (next != freeBlocks.end())
+        {
+            long long nextSize = next->second;
+            eraseFree(offset + size, nextSize);
+            size += nextSize;
+        }
+        auto previous = freeBlocks.lower_bound(offset);
+        if (previous != freeBlocks.begin())
+        {
+            --previous;
+            if (previous->first + previous->second == offset)
+            {
+                long long previousOffset = previous->first, previousSize = previous->second;
+                eraseFree(previousOffset, previousSize);
+                offset = previousOffset;
+                size += previousSize;
+            }
+        }
+        insertFree(offset, size);
+    }
+
+    long long reservedBytes() const override
+    {
+        return reserved;
+    }
+
+    long long freeBytes() const override
+    {
+        return free;
+    }
+
+    long long usableFree(long long size) const override
     {
-        std::queue<Request> newQueue;
-        while (!activeRequests.empty())
+        long long need = (size + alignment - 1) / alignment * alignment;
+        long long usable = 0;
+        for (const auto &block : freeBlocks)
         {
-            Request request = activeRequests.front();
-            activeRequests.pop();
-            request.persistence--;
-            if (request.persistence > 0)
+            if (block.second >= need)
             {
-                newQueue.push(request);
+                usable += block.second;
             }
         }
-        activeRequests = newQueue;
+        return usable;
     }
 };
 
-int main()
+// Real memory from one region mapped from the system, carved into pages.
+// Requests up to 32 KiB take a slot of the smallest size class that fits:
+// multiples of 16 bytes up to 128, then four classes per doubling. Each
+// class cuts runs of pages (spans) into slots on demand, and a free slot
+// holds the pointer to the next free one. Larger requests take a run of
+// whole pages of their own, found first-fit in a bitmap of free pages.
+//
+// Each thread keeps a cache of free slots per class, so most allocations
+// and frees touch no lock. An empty cache takes a batch of slots from the
+// class's central list, and a cache holding two batches gives one back;
+// only those transfers lock, one class at a time. A slot may be freed by
+// any thread. Spans stay with their class once cut; runs for large
+// requests go back to the free pages.
+//
+// allocate and free are safe to call from any thread. The Allocator
+// interface, which keeps requests by id, is for one thread at a time.
+class ArenaAllocator : public Allocator
 {
-    srand(time(0));
-    std::vector<int> pageSizes = {128, 256, 512, 1024};
+    static constexpr std::size_t maxSmall = 32 << 10;
+    static constexpr int numClasses = 40;            // the class of maxSmall, plus one
+    static constexpr std::size_t minSpan = 64 << 10; // bytes cut into slots at a time
+    static constexpr std::uint8_t largeRun = 0xFF;   // first page of a large request
+    static constexpr std::uint8_t noClass = 0;       // a free page, or inside a large run
 
-    for (int pageSize : pageSizes)
+    // Slots move between a cache and the central list as a chain linked
+    // through their first bytes
+    static void *&nextOf(void *slot)
+    {
+        return *static_cast<void **>(slot);
+    }
+
+    static int classOf(std::size_t size)
+    {
+        if (size <= 128)
+        {
+            return size == 0 ? 0 : static_cast<int>((size + 15) / 16) - 1;
+        }
+        std::size_t last = size - 1;
+        int power = 63 - __builtin_clzll(last);
+        return 8 + (power - 7) * 4 + static_cast<int>(last >> (power - 2) & 3);
+    }
+
+    static std::size_t classSize(int sizeClass)
+    {
+        if (sizeClass < 8)
+        {
+            return 16 * (sizeClass + 1);
+        }
+        int power = 7 + (sizeClass - 8) / 4;
+        return (std::size_t(1) << power) + ((sizeClass - 8) % 4 + 1) * (std::size_t(1) << (power - 2));
+    }
+
+    // Slots a cache takes from or gives back to the central list at once
+    static int batchFor(int sizeClass)
+    {
+        return static_cast<int>(std::clamp<std::size_t>((32 << 10) / classSize(sizeClass), 4, 64));
+    }
+
+    struct Central
+    {
+        std::mutex lock;
+        void *head = nullptr;
+    };
+
+    // The state threads share; caches refer to it weakly, so a thread that
+    // outlives the allocator drops its cache instead of flushing it
+    struct Heap
+    {
+        std::uint64_t id;
+        char *base;
+        std::size_t bytes;
+        std::size_t pageSize;
+        std::size_t numPages;
+
+        std::mutex pageLock; // guards the page bitmap and runLength
+        std::vector<std::uint64_t> freeBitmap;
+        std::size_t firstFreeWord = 0; // no word before this one has a free page
+        std::vector<std::uint8_t> pageClass; // class + 1 of a span's pages, or largeRun
+        std::vector<std::uint32_t> runLength; // pages of a large request, at its first page
+        Central centrals[numClasses];
+
+        ~Heap()
+        {
+            if (base)
+            {
+#ifdef _WIN32
+                VirtualFree(base, 0, MEM_RELEASE);
+#else
+                munmap(base, bytes);
+#endif
+            }
+        }
+    };
+
+    struct ThreadCache
     {
-        MemoryManager memoryManager(pageSize);
-        int numRequests = 1000;
-        int successfulRequests = 0;
+        std::weak_ptr<Heap> heap;
+        std::uint64_t heapId;
+        void *heads[numClasses] = {};
+        int counts[numClasses] = {};
 
-        for (int i = 0; i < numRequests; i++)
+        // Give every cached slot back when the thread ends
+        ~ThreadCache()
         {
-            int requestSize = rand() % (MAX_REQUEST_SIZE - MIN_REQUEST_SIZE + 1) + MIN_REQUEST_SIZE;
-            int persistence = rand() % 10 + 1;
+            std::shared_ptr<Heap> live = heap.lock();
+            for (int c = 0; live && c < numClasses; c++)
+            {
+                if (!heads[c])
+                {
+                    continue;
+                }
+                void *last = heads[c];
+                while (nextOf(last))
+                {
+                    last = nextOf(last);
+                }
+                std::lock_guard<std::mutex> guard(live->centrals[c].lock);
+                nextOf(last) = live->centrals[c].head;
+                live->centrals[c].head = heads[c];
+            }
+        }
+    };
 
-            Request request = {i, requestSize, persistence};
+    std::shared_ptr<Heap> heap;
+    std::unordered_map<int, void *> blocks; // by request id, for the Allocator interface
+    long long reserved = 0;
 
-            bool success = memoryManager.allocateMemory(request);
-            if (success)
+    // The calling thread's cache for this allocator
+    ThreadCache &cache()
+    {
+        static thread_local std::vector<std::unique_ptr<ThreadCache>> caches;
+        static thread_local ThreadCache *last = nullptr;
+        if (last && last->heapId == heap->id)
+        {
+            return *last;
+        }
+        for (const auto &candidate : caches)
+        {
+            if (candidate->heapId == heap->id)
             {
-                successfulRequests++;
+                return *(last = candidate.get());
             }
-            memoryManager.decrementPersistence();
-            memoryManager.releaseMemory();
         }
+        // Drop the caches of allocators that are gone
+        caches.erase(std::remove_if(caches.begin(), caches.end(), [](const std::unique_ptr<ThreadCache> &candidate)
+                                    { return candidate->heap.expired(); }),
+                     caches.end());
+        caches.push_back(std::make_unique<ThreadCache>());
+        caches.back()->heap = heap;
+        caches.back()->heapId = heap->id;
+        return *(last = caches.back().get());
+    }
 
-        std::cout << "Page size: " << pageSize << ", Successful requests: " << successfulRequests << std::endl;
+    // Take a run of free pages, first fit; returns its first page, or
+    // numPages if there is none. Call with pageLock held.
+    std::size_t takePages(std::size_t count)
+    {
+        std::size_t run = 0;
+        std::size_t page = heap->firstFreeWord * 64;
+        while (run < count && page < heap->numPages)
+        {
+            std::uint64_t word = heap->freeBitmap[page / 64] >> (page % 64);
+            if (page % 64 == 0 && word == ~std::uint64_t(0) && count - run >= 64)
+            {
+                run += 64;
+                page += 64;
+            }
+            else if (word & 1)
+            {
+                run++;
+                page++;
+            }
+            else
+            {
+                // Skip the used pages up to the next free one in this word
+                run = 0;
+                page = word == 0 ? (page / 64 + 1) * 64 : page + __builtin_ctzll(word);
+            }
+        }
+        if (run < count)
+        {
+            return heap->numPages;
+        }
+        std::size_t first = page - count;
+        for (std::size_t p = first; p < page; p++)
+        {
+            heap->freeBitmap[p / 64] &= ~(std::uint64_t(1) << (p % 64));
+        }
+        while (heap->firstFreeWord < heap->freeBitmap.size() && heap->freeBitmap[heap->firstFreeWord] == 0)
+        {
+            heap->firstFreeWord++;
+        }
+        return first;
+    }
+
+    // Call with pageLock held
+    void returnPages(std::size_t first, std::size_t count)
+    {
+        for (std::size_t p = first; p < first + count; p++)
+        {
+            heap->freeBitmap[p / 64] |= std::uint64_t(1) << (p % 64);
+        }
+        heap->firstFreeWord = std::min(heap->firstFreeWord, first / 64);
+    }
+
+    // Fill an empty cache with a batch of slots, cutting a new span if the
+    // central list is empty too; false when memory is used up
+    bool refill(ThreadCache &local, int sizeClass)
+    {
+        Central &central = heap->centrals[sizeClass];
+        std::lock_guard<std::mutex> guard(central.lock);
+        if (!central.head)
+        {
+            std::size_t size = classSize(sizeClass);
+            std::size_t pages = (std::max(minSpan, 8 * size) + heap->pageSize - 1) / heap->pageSize;
+            std::size_t first;
+            {
+                std::lock_guard<std::mutex> pages_guard(heap->pageLock);
+                first = takePages(pages);
+                if (first == heap->numPages)
+                {
+                    return false;
+                }
+                std::fill(heap->pageClass.begin() + first, heap->pageClass.begin() + first + pages, sizeClass + 1);
+            }
+            // Chain the slots in address order
+            char *span = heap->base + first * heap->pageSize;
+            std::size_t slots = pages * heap->pageSize / size;
+            for (std::size_t i = slots; i-- > 0;)
+            {
+                nextOf(span + i * size) = central.head;
+                central.head = span + i * size;
+            }
+        }
+        int batch = batchFor(sizeClass);
+        while (central.head && local.counts[sizeClass] < batch)
+        {
+            void *slot = central.head;
+            central.head = nextOf(slot);
+            nextOf(slot) = local.heads[sizeClass];
+            local.heads[sizeClass] = slot;
+            local.counts[sizeClass]++;
+        }
+        return true;
+    }
+
+    // Give a batch of a full cache's slots back to the central list
+    void drain(ThreadCache &local, int sizeClass)
+    {
+        int batch = batchFor(sizeClass);
+        void *first = local.heads[sizeClass], *last = first;
+        for (int i = 1; i < batch; i++)
+        {
+            last = nextOf(last);
+        }
+        local.heads[sizeClass] = nextOf(last);
+        local.counts[sizeClass] -= batch;
+
+        Central &central = heap->centrals[sizeClass];
+        std::lock_guard<std::mutex> guard(central.lock);
+        nextOf(last) = central.head;
+        central.head = first;
+    }
+
+    // Bytes a request of size takes
+    std::size_t footprint(std::size_t size) const
+    {
+        if (size <= maxSmall)
+        {
+            return classSize(classOf(size));
+        }
+        return (size + heap->pageSize - 1) / heap->pageSize * heap->pageSize;
+    }
+
+public:
+    // Map memorySize bytes, in pages of pageSize bytes; a failed mapping
+    // leaves an allocator with no memory
+    ArenaAllocator(std::size_t memorySize, std::size_t pageSize = 4096) : heap(std::make_shared<Heap>())
+    {
+        static std::atomic<std::uint64_t> nextId{0};
+        heap->id = nextId++;
+        heap->pageSize = pageSize;
+        heap->numPages = memorySize / pageSize;
+        heap->bytes = heap->numPages * pageSize;
+        void *region = nullptr;
+        if (heap->bytes > 0)
+        {
+#ifdef _WIN32
+            region = VirtualAlloc(nullptr, heap->bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+            region = mmap(nullptr, heap->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+            {
+                region = nullptr;
+            }
+#endif
+        }
+        if (!region)
+        {
+            heap->base = nullptr;
+            heap->numPages = 0;
+            heap->bytes = 0;
+        }
+        else
+        {
+            heap->base = static_cast<char *>(region);
+        }
+
+        heap->freeBitmap.assign((heap->numPages + 63) / 64, ~std::uint64_t(0));
+        if (heap->numPages % 64 != 0)
+        {
+            heap->freeBitmap.back() = (std::uint64_t(1) << (heap->numPages % 64)) - 1;
+        }
+        heap->pageClass.assign(heap->numPages, noClass);
+        heap->runLength.assign(heap->numPages, 0);
+    }
+
+    // Return size usable bytes, aligned to 16 bytes, or null when memory is
+    // used up
+    void *allocate(std::size_t size)
+    {
+        if (size > maxSmall)
+        {
+            std::size_t pages = (size + heap->pageSize - 1) / heap->pageSize;
+            std::lock_guard<std::mutex> guard(heap->pageLock);
+            std::size_t first = takePages(pages);
+            if (first == heap->numPages)
+            {
+                return nullptr;
+            }
+            heap->pageClass[first] = largeRun;
+            heap->runLength[first] = static_cast<std::uint32_t>(pages);
+            return heap->base + first * heap->pageSize;
+        }
+
+        int sizeClass = classOf(size);
+        ThreadCache &local = cache();
+        if (!local.heads[sizeClass] && !refill(local, sizeClass))
+        {
+            return nullptr;
+        }
+        void *slot = local.heads[sizeClass];
+        local.heads[sizeClass] = nextOf(slot);
+        local.counts[sizeClass]--;
+        return slot;
+    }
+
+    // Free memory from allocate; pointer may be null
+    void free(void *pointer)
+    {
+        if (!pointer)
+        {
+            return;
+        }
+        std::size_t page = (static_cast<char *>(pointer) - heap->base) / heap->pageSize;
+        std::uint8_t owner = heap->pageClass[page];
+        if (owner == largeRun)
+        {
+            std::lock_guard<std::mutex> guard(heap->pageLock);
+            heap->pageClass[page] = noClass;
+            returnPages(page, heap->runLength[page]);
+            return;
+        }
+
+        int sizeClass = owner - 1;
+        ThreadCache &local = cache();
+        nextOf(pointer) = local.heads[sizeClass];
+        local.heads[sizeClass] = pointer;
+        if (++local.counts[sizeClass] >= 2 * batchFor(sizeClass))
+        {
+            drain(local, sizeClass);
+        }
+    }
+
+    std::string name() const override
+    {
+        return "arena (" + std::to_string(heap->pageSize) + " B pages)";
+    }
+
+    bool allocate(int id, int size) override
+    {
+        void *pointer = allocate(static_cast<std::size_t>(size));
+        if (!pointer)
+        {
+            return false;
+        }
+        blocks[id] = pointer;
+        reserved += footprint(size);
+        return true;
+    }
+
+    void release(int id) override
+    {
+        auto it = blocks.find(id);
+        if (it == blocks.end())
+        {
+            return;
+        }
+        std::size_t page = (static_cast<char *>(it->second) - heap->base) / heap->pageSize;
+        reserved -= heap->pageClass[page] == largeRun ? heap->runLength[page] * heap->pageSize
+                                                       : classSize(heap->pageClass[page] - 1);
+        free(it->second);
+        blocks.erase(it);
+    }
+
+    long long reservedBytes() const override
+    {
+        return reserved;
+    }
+
+    // Includes slots cut for a class but not in use, which only requests of
+    // that class can take
+    long long freeBytes() const override
+    {
+        return static_cast<long long>(heap->bytes) - reserved;
+    }
+
+    // Runs of free pages long enough for the request, or for a span of
+    // its class. Free slots already cut are not counted: they sit in
+    // thread caches that other threads cannot inspect.
+    long long usableFree(long long size) const override
+    {
+        std::size_t bytes = size > static_cast<long long>(maxSmall)
+                                ? static_cast<std::size_t>(size)
+                                : std::max(minSpan, 8 * classSize(classOf(static_cast<std::size_t>(size))));
+        std::size_t need = (bytes + heap->pageSize - 1) / heap->pageSize;
+        std::lock_guard<std::mutex> guard(heap->pageLock);
+        std::size_t usable = 0, run = 0;
+        for (std::size_t page = 0; page <= heap->numPages; page++)
+        {
+            if (page < heap->numPages && heap->freeBitmap[page / 64] >> (page % 64) & 1)
+            {
+                run++;
+                continue;
+            }
+            usable += run >= need ? run : 0;
+            run = 0;
+        }
+        return static_cast<long long>(usable * heap->pageSize);
+    }
+};
+
+// Hierarchical timing wheel: requests are filed by the tick at which they
+// expire in four wheels of 256 slots, a slot of each wheel spanning 256
+// times the ticks of one in the wheel below. A request due within 256
+// ticks sits in the bottom wheel; later ones sit higher and move down a
+// wheel each time the clock reaches the span of their slot. Each tick then
+// costs time for the requests that expire or move, not for every request
+// held, and the four wheels cover 2^32 ticks, beyond any int persistence.
+class TimingWheel
+{
+    static const int levels = 4;
+    static const int slotBits = 8;
+    static const int slots = 1 << slotBits;
+
+    struct Timer
+    {
+        long long expiry;
+        Request request;
+    };
+
+    std::vector<Timer> wheels[levels][slots];
+    long long now = 0;
+
+    // File a timer in the lowest wheel whose range reaches its expiry
+    void place(const Timer &timer)
+    {
+        long long delta = timer.expiry - now;
+        int level = 0;
+        while (level < levels - 1 && delta >= (1LL << (slotBits * (level + 1))))
+        {
+            level++;
+        }
+        wheels[level][(timer.expiry >> (slotBits * level)) & (slots - 1)].push_back(timer);
+    }
+
+public:
+    long long currentTick() const
+    {
+        return now;
+    }
+
+    // Add a request to expire at the given tick, or at the next one if that
+    // has passed
+    void add(const Request &request, long long expiry)
+    {
+        place({std::max(expiry, now + 1), request});
+    }
+
+    // Move the clock one tick on and append the requests that expire at it
+    void advance(std::vector<Request> &expired)
+    {
+        now++;
+
+        // At the start of a slot's span, move its timers down. Higher wheels
+        // go first, as what they move down may land in a lower wheel's slot
+        // that starts now too.
+        int top = 0;
+        while (top < levels - 1 && (now & ((1LL << (slotBits * (top + 1))) - 1)) == 0)
+        {
+            top++;
+        }
+        for (int level = top; level >= 1; level--)
+        {
+            std::vector<Timer> moving;
+            moving.swap(wheels[level][(now >> (slotBits * level)) & (slots - 1)]);
+            for (const Timer &timer : moving)
+            {
+                place(timer);
+            }
+        }
+
+        std::vector<Timer> &due = wheels[0][now & (slots - 1)];
+        for (const Timer &timer : due)
+        {
+            expired.push_back(timer.request);
+        }
+        due.clear();
+    }
+};
+
+class MemoryManager
+{
+    std::unique_ptr<Allocator> allocator;
+    ArenaAllocator *arena;        // the backend, when it hands out real memory
+    TimingWheel expiries;
+    std::vector<Request> expired; // requests whose time is up, not yet released
+    long long requestedBytes = 0; // bytes asked for by requests holding memory
+
+public:
+    MemoryManager(std::unique_ptr<Allocator> allocator)
+        : allocator(std::move(allocator)), arena(dynamic_cast<ArenaAllocator *>(this->allocator.get())) {}
+
+    MemoryManager(int pageSize, long long memorySize = MEMORY_SIZE)
+        : MemoryManager(std::make_unique<PagingAllocator>(pageSize, memorySize)) {}
+
+    bool allocateMemory(Request request)
+    {
+        if (!allocator->allocate(request.id, request.size))
+        {
+            return false;
+        }
+        requestedBytes += request.size;
+        expiries.add(request, expiries.currentTick() + request.persistence);
+        return true;
+    }
+
+    // Free the memory of every request that has expired
+    void releaseMemory()
+    {
+        for (const Request &request : expired)
+        {
+            allocator->release(request.id);
+            requestedBytes -= request.size;
+        }
+        expired.clear();
+    }
+
+    // Move on one tick; requests whose persistence runs out are released
+    // by the next releaseMemory
+    void decrementPersistence()
+    {
+        expiries.advance(expired);
+    }
+
+    // Real memory, with an arena backend; safe to call from any thread,
+    // unlike the request methods. Null when memory is used up or the
+    // backend only keeps accounts.
+    void *allocate(std::size_t size)
+    {
+        return arena ? arena->allocate(size) : nullptr;
+    }
+
+    void free(void *pointer)
+    {
+        if (arena)
+        {
+            arena->free(pointer);
+        }
+    }
+
+    const Allocator &backend() const
+    {
+        return *allocator;
+    }
+
+    // Share of the reserved memory that rounding added to requests
+    double internalFragmentation() const
+    {
+        long long reserved = allocator->reservedBytes();
+        return reserved > 0 ? 1.0 - static_cast<double>(requestedBytes) / reserved : 0;
+    }
+
+    // Share of the free memory in pieces that cannot take a request of the
+    // largest size, the same measure for every allocator
+    double externalFragmentation() const
+    {
+        long long free = allocator->freeBytes();
+        return free > 0 ? 1.0 - static_cast<double>(allocator->usableFree(MAX_REQUEST_SIZE)) / free : 0;
+    }
+};
+
+// Function to run the request sequence through an allocator and report its
+// success rate, mean fragmentation after each request and time per request.
+// The sequence runs twice: once timed, once sampling fragmentation, which
+// takes longer than the requests themselves.
+void runExperiment(const std::function<std::unique_ptr<Allocator>()> &makeAllocator, const std::vector<Request> &requests)
+{
+    MemoryManager timed(makeAllocator());
+    auto start = std::chrono::steady_clock::now();
+    for (const Request &request : requests)
+    {
+        timed.allocateMemory(request);
+        timed.decrementPersistence();
+        timed.releaseMemory();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    MemoryManager memoryManager(makeAllocator());
+    int successfulRequests = 0;
+    double internal = 0, external = 0;
+    for (const Request &request : requests)
+    {
+        if (memoryManager.allocateMemory(request))
+        {
+            successfulRequests++;
+        }
+        memoryManager.decrementPersistence();
+        memoryManager.releaseMemory();
+        internal += memoryManager.internalFragmentation();
+        external += memoryManager.externalFragmentation();
+    }
+
+    int numRequests = requests.size();
+    std::cout << memoryManager.backend().name() << ": Successful requests: " << successfulRequests
+              << " (" << 100.0 * successfulRequests / numRequests << "%), internal fragmentation: "
+              << 100.0 * internal / numRequests << "%, external fragmentation: " << 100.0 * external / numRequests
+              << "%, ns per request: " << elapsed.count() / numRequests << std::endl;
+}
+
+// A reference to memory by a process, as found in a trace
+struct Reference
+{
+    std::uint32_t process;
+    std::uint64_t address;
+    bool write;
+};
+
+// Interface for a stream of references, read one at a time so traces need
+// not fit in memory
+class ReferenceSource
+{
+public:
+    virtual ~ReferenceSource() {}
+
+    // Read the next reference; false at the end or on an error
+    virtual bool next(Reference &reference) = 0;
+
+    std::string error; // set when reading stopped early
+};
+
+// A trace file read in fixed-size chunks: CSV lines of
+// "process,address[,r|w]" (the address in decimal or 0x hex, w marking a
+// write; blank lines, '#' comments and a header line are skipped), or, for
+// names ending in .bin, 16-byte little-endian records of a
+// 32-bit process, 32-bit flags (bit 0 for a write) and 64-bit address
+class TraceReferences : public ReferenceSource
+{
+    static const std::size_t chunkSize = 1 << 20;
+    static const std::size_t recordSize = 16;
+
+    std::string path;
+    FILE *file;
+    bool binary;
+    std::vector<char> buffer;
+    std::size_t position = 0; // next unread byte in buffer
+    std::size_t end = 0;      // end of the bytes read into buffer
+    long long lineNumber = 0;
+
+    // Make at least want unread bytes available; false if the file ends first
+    bool fill(std::size_t want)
+    {
+        if (end - position >= want)
+        {
+            return true;
+        }
+        std::memmove(buffer.data(), buffer.data() + position, end - position);
+        end -= position;
+        position = 0;
+        if (want > buffer.size())
+        {
+            buffer.resize(want);
+        }
+        while (end < want && !std::feof(file))
+        {
+            end += std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+            if (std::ferror(file))
+            {
+                error = path + ": read error";
+                return false;
+            }
+        }
+        return end >= want;
+    }
+
+    bool nextBinary(Reference &reference)
+    {
+        if (!fill(recordSize))
+        {
+            if (end != position && error.empty())
+            {
+                error = path + ": truncated record at the end";
+            }
+            return false;
+        }
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(buffer.data() + position);
+        auto little = [&](int offset, int count)
+        {
+            std::uint64_t value = 0;
+            for (int i = count - 1; i >= 0; i--)
+            {
+                value = value << 8 | bytes[offset + i];
+            }
+            return value;
+        };
+        reference = {static_cast<std::uint32_t>(little(0, 4)), little(8, 8), (little(4, 4) & 1) != 0};
+        position += recordSize;
+        return true;
+    }
+
+    bool nextLine(Reference &reference)
+    {
+        while (true)
+        {
+            // Find the end of the next line, reading more as needed
+            std::size_t scanned = 0, length;
+            while (true)
+            {
+                if (!fill(scanned + 1))
+                {
+                    if (end == position)
+                    {
+                        return false;
+                    }
+                    length = end - position; // the last line has no line ending
+                    break;
+                }
+                const char *start = buffer.data() + position;
+                const char *newline = static_cast<const char *>(std::memchr(start + scanned, '\n', end - position - scanned));
+                if (newline)
+                {
+                    length = newline - start;
+                    break;
+                }
+                scanned = end - position;
+            }
+            const char *line = buffer.data() + position, *lineEnd = line + length;
+            position = std::min(end, position + length + 1);
+            lineNumber++;
+            if (lineEnd > line && lineEnd[-1] == '\r')
+            {
+                lineEnd--;
+            }
+            if (line == lineEnd || line[0] == '#' || (lineNumber == 1 && !std::isdigit(static_cast<unsigned char>(line[0]))))
+            {
+                continue;
+            }
+
+            std::uint32_t process;
+            std::uint64_t address;
+            auto result = std::from_chars(line, lineEnd, process);
+            const char *cursor = result.ptr;
+            bool valid = result.ec == std::errc() && cursor < lineEnd && *cursor++ == ',';
+            if (valid)
+            {
+                bool hex = lineEnd - cursor > 2 && cursor[0] == '0' && (cursor[1] == 'x' || cursor[1] == 'X');
+                result = std::from_chars(cursor + (hex ? 2 : 0), lineEnd, address, hex ? 16 : 10);
+                cursor = result.ptr;
+                valid = result.ec == std::errc();
+            }
+            bool write = false;
+            if (valid && cursor != lineEnd)
+            {
+                write = lineEnd - cursor == 2 && cursor[0] == ',' && (cursor[1] == 'w' || cursor[1] == 'W');
+                valid = write || (lineEnd - cursor == 2 && cursor[0] == ',' && (cursor[1] == 'r' || cursor[1] == 'R'));
+            }
+            if (!valid)
+            {
+                error = path + ":" + std::to_string(lineNumber) + ": expected process,address[,r|w]";
+                return false;
+            }
+            reference = {process, address, write};
+            return true;
+        }
+    }
+
+public:
+    TraceReferences(const std::string &path) : path(path), buffer(chunkSize)
+    {
+        binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+        file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            error = path + ": " + std::strerror(errno);
+        }
+    }
+
+    ~TraceReferences() override
+    {
+        if (file)
+        {
+            std::fclose(file);
+        }
+    }
+
+    bool next(Reference &reference) override
+    {
+        if (!file || !error.empty())
+        {
+            return false;
+        }
+        return binary ? nextBinary(reference) : nextLine(reference);
+    }
+};
+
+// Ways of generating references with locality
+enum class LocalityModel
+{
+    workingSet, // mostly within a small set of pages that moves now and then
+    loop,       // each process sweeps its address space in order, over and over
+    random      // any page of the address space, uniformly
+};
+
+// References generated by processes with their own virtual address spaces,
+// drawn like the allocation experiment's requests: a request's size is the
+// number of pages in its address space and its persistence how many bursts
+// it runs before a new process replaces it. Processes take turns in bursts
+// of references; the same seed always gives the same references.
+class GeneratedReferences : public ReferenceSource
+{
+    struct Process
+    {
+        Request request;
+        std::uint64_t pages;      // size of the address space
+        std::uint64_t setStart;   // first page of the working set
+        std::uint64_t cursor = 0; // next page of a loop
+    };
+
+    LocalityModel model;
+    std::uint64_t remaining;
+    int pageSize;
+    std::mt19937_64 rng;
+    std::vector<Process> processes;
+    int nextId = 0;
+    std::size_t current = 0;
+    int burstLeft = 0;
+
+    static const int burst = 64;          // references per turn
+    static const int workingSetPages = 8; // pages in a working set
+    static const int phase = 4096;        // references between working set moves
+    std::uint64_t sincePhase = 0;
+
+    Process newProcess()
+    {
+        int size = rng() % (MAX_REQUEST_SIZE - MIN_REQUEST_SIZE + 1) + MIN_REQUEST_SIZE;
+        int persistence = rng() % 10 + 1;
+        Process process{{nextId++, size, persistence}, static_cast<std::uint64_t>(size), 0};
+        process.setStart = rng() % process.pages;
+        return process;
+    }
+
+public:
+    GeneratedReferences(LocalityModel model, std::uint64_t count, int numProcesses, int pageSize, std::uint64_t seed)
+        : model(model), remaining(count), pageSize(pageSize), rng(seed)
+    {
+        for (int i = 0; i < numProcesses; i++)
+        {
+            processes.push_back(newProcess());
+        }
+    }
+
+    bool next(Reference &reference) override
+    {
+        if (remaining == 0)
+        {
+            return false;
+        }
+        remaining--;
+
+        // Move to the next process at the end of a burst, replacing one that
+        // has run for its persistence
+        if (burstLeft == 0)
+        {
+            current = (current + 1) % processes.size();
+            if (--processes[current].request.persistence < 0)
+            {
+                processes[current] = newProcess();
+            }
+            burstLeft = burst;
+        }
+        burstLeft--;
+
+        Process &process = processes[current];
+        std::uint64_t page;
+        if (model == LocalityModel::loop)
+        {
+            page = process.cursor;
+            process.cursor = (process.cursor + 1) % process.pages;
+        }
+        else if (model == LocalityModel::random || rng() % 10 == 0)
+        {
+            page = rng() % process.pages;
+        }
+        else
+        {
+            page = (process.setStart + rng() % workingSetPages) % process.pages;
+        }
+        if (model == LocalityModel::workingSet && ++sincePhase == phase)
+        {
+            sincePhase = 0;
+            for (Process &p : processes)
+            {
+                p.setStart = rng() % p.pages;
+            }
+        }
+
+        reference = {static_cast<std::uint32_t>(process.request.id), page * pageSize + rng() % pageSize, rng() % 4 == 0};
+        return true;
+    }
+};
+
+// Open-addressing hash map from page keys to numbers, with linear probing
+// and deletion by shifting entries back, so lookups stay O(1) with no
+// allocation per page
+class PageMap
+{
+    static constexpr std::uint64_t empty = ~std::uint64_t(0);
+    std::vector<std::uint64_t> keys;
+    std::vector<std::int64_t> values;
+    std::size_t mask;
+    int shift; // 64 less the bits of a slot number
+    std::size_t count = 0;
+
+    // Fibonacci hashing: the top bits of the product depend on every bit
+    // of the key
+    std::size_t slotFor(std::uint64_t key) const
+    {
+        return (key * 0x9E3779B97F4A7C15ULL) >> shift;
+    }
+
+    void setCapacity(std::size_t capacity)
+    {
+        keys.assign(capacity, empty);
+        values.assign(capacity, 0);
+        mask = capacity - 1;
+        shift = 64 - __builtin_ctzll(capacity);
+    }
+
+    void grow()
+    {
+        std::vector<std::uint64_t> oldKeys = std::move(keys);
+        std::vector<std::int64_t> oldValues = std::move(values);
+        setCapacity(oldKeys.size() * 2);
+        count = 0;
+        for (std::size_t i = 0; i < oldKeys.size(); i++)
+        {
+            if (oldKeys[i] != empty)
+            {
+                set(oldKeys[i], oldValues[i]);
+            }
+        }
+    }
+
+public:
+    PageMap(std::size_t expected = 16)
+    {
+        std::size_t capacity = 16;
+        while (capacity < expected * 2)
+        {
+            capacity *= 2;
+        }
+        setCapacity(capacity);
+    }
+
+    // Return the number stored for key, or -1
+    std::int64_t find(std::uint64_t key) const
+    {
+        for (std::size_t slot = slotFor(key);; slot = (slot + 1) & mask)
+        {
+            if (keys[slot] == key)
+            {
+                return values[slot];
+            }
+            if (keys[slot] == empty)
+            {
+                return -1;
+            }
+        }
+    }
+
+    void set(std::uint64_t key, std::int64_t value)
+    {
+        if ((count + 1) * 2 > keys.size())
+        {
+            grow();
+        }
+        std::size_t slot = slotFor(key);
+        while (keys[slot] != empty && keys[slot] != key)
+        {
+            slot = (slot + 1) & mask;
+        }
+        if (keys[slot] == empty)
+        {
+            count++;
+        }
+        keys[slot] = key;
+        values[slot] = value;
+    }
+
+    void erase(std::uint64_t key)
+    {
+        std::size_t slot = slotFor(key);
+        while (keys[slot] != key)
+        {
+            if (keys[slot] == empty)
+            {
+                return;
+            }
+            slot = (slot + 1) & mask;
+        }
+        // Shift back later entries of the run that would no longer be found
+        std::size_t hole = slot;
+        for (std::size_t next = (hole + 1) & mask; keys[next] != empty; next = (next + 1) & mask)
+        {
+            std::size_t home = slotFor(keys[next]);
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                keys[hole] = keys[next];
+                values[hole] = values[next];
+                hole = next;
+            }
+        }
+        keys[hole] = empty;
+        count--;
+    }
+};
+
+// What happened on one reference
+struct Access
+{
+    bool hit;
+    int frame;            // the frame holding the page afterwards
+    bool evicted;         // a page was removed to make room
+    std::uint64_t victim; // the page removed
+};
+
+// Interface for a page-replacement policy over a fixed number of frames.
+// Pages are keys combining a process with a virtual page number.
+class ReplacementPolicy
+{
+public:
+    virtual ~ReplacementPolicy() {}
+
+    virtual std::string name() const = 0;
+
+    virtual Access access(std::uint64_t page, bool write) = 0;
+};
+
+// Evict the page loaded longest ago
+class FifoPolicy : public ReplacementPolicy
+{
+    int frames;
+    int used = 0;
+    int hand = 0; // the oldest frame once all are used
+    std::vector<std::uint64_t> pageOf;
+    PageMap where;
+
+public:
+    FifoPolicy(int frames) : frames(frames), pageOf(frames), where(frames) {}
+
+    std::string name() const override
+    {
+        return "FIFO";
+    }
+
+    Access access(std::uint64_t page, bool) override
+    {
+        std::int64_t frame = where.find(page);
+        if (frame >= 0)
+        {
+            return {true, static_cast<int>(frame), false, 0};
+        }
+        Access result{false, 0, false, 0};
+        if (used < frames)
+        {
+            result.frame = used++;
+        }
+        else
+        {
+            result = {false, hand, true, pageOf[hand]};
+            where.erase(pageOf[hand]);
+            hand = (hand + 1) % frames;
+        }
+        pageOf[result.frame] = page;
+        where.set(page, result.frame);
+        return result;
+    }
+};
+
+// Evict the page used longest ago. The frames form a doubly linked list in
+// order of use, so every reference is O(1).
+class LruPolicy : public ReplacementPolicy
+{
+    int frames;
+    int used = 0;
+    std::vector<std::uint64_t> pageOf;
+    std::vector<int> previous, next; // towards the most and least recent
+    int head = -1, tail = -1;        // most and least recently used
+    PageMap where;
+
+    void unlink(int frame)
+    {
+        (previous[frame] >= 0 ? next[previous[frame]] : head) = next[frame];
+        (next[frame] >= 0 ? previous[next[frame]] : tail) = previous[frame];
+    }
+
+    void pushFront(int frame)
+    {
+        previous[frame] = -1;
+        next[frame] = head;
+        (head >= 0 ? previous[head] : tail) = frame;
+        head = frame;
+    }
+
+public:
+    LruPolicy(int frames) : frames(frames), pageOf(frames), previous(frames), next(frames), where(frames) {}
+
+    std::string name() const override
+    {
+        return "LRU";
+    }
+
+    Access access(std::uint64_t page, bool) override
+    {
+        std::int64_t found = where.find(page);
+        if (found >= 0)
+        {
+            int frame = static_cast<int>(found);
+            if (frame != head)
+            {
+                unlink(frame);
+                pushFront(frame);
+            }
+            return {true, frame, false, 0};
+        }
+        Access result{false, 0, false, 0};
+        if (used < frames)
+        {
+            result.frame = used++;
+        }
+        else
+        {
+            result = {false, tail, true, pageOf[tail]};
+            where.erase(pageOf[tail]);
+            unlink(tail);
+        }
+        pageOf[result.frame] = page;
+        where.set(page, result.frame);
+        pushFront(result.frame);
+        return result;
+    }
+};
+
+// CLOCK: frames in a circle with a referenced bit each; the hand clears
+// set bits as it passes and evicts the first page whose bit is clear
+class ClockPolicy : public ReplacementPolicy
+{
+    int frames;
+    int used = 0;
+    int hand = 0;
+    std::vector<std::uint64_t> pageOf;
+    std::vector<char> referenced;
+    PageMap where;
+
+public:
+    ClockPolicy(int frames) : frames(frames), pageOf(frames), referenced(frames), where(frames) {}
+
+    std::string name() const override
+    {
+        return "CLOCK";
+    }
+
+    Access access(std::uint64_t page, bool) override
+    {
+        std::int64_t frame = where.find(page);
+        if (frame >= 0)
+        {
+            referenced[frame] = 1;
+            return {true, static_cast<int>(frame), false, 0};
+        }
+        Access result{false, 0, false, 0};
+        if (used < frames)
+        {
+            result.frame = used++;
+        }
+        else
+        {
+            while (referenced[hand])
+            {
+                referenced[hand] = 0;
+                hand = (hand + 1) % frames;
+            }
+            result = {false, hand, true, pageOf[hand]};
+            where.erase(pageOf[hand]);
+            hand = (hand + 1) % frames;
+        }
+        pageOf[result.frame] = page;
+        referenced[result.frame] = 1;
+        where.set(page, result.frame);
+        return result;
+    }
+};
+
+// Enhanced second chance: like CLOCK, but with a modified bit as well, so
+// clean pages are evicted before dirty ones that would have to be written
+// to swap. The hand first looks for a page neither referenced nor
+// modified, then for one not referenced, clearing referenced bits as it
+// goes, and repeats.
+class SecondChancePolicy : public ReplacementPolicy
+{
+    int frames;
+    int used = 0;
+    int hand = 0;
+    std::vector<std::uint64_t> pageOf;
+    std::vector<char> referenced, modified;
+    PageMap where;
+
+    int findVictim()
+    {
+        while (true)
+        {
+            for (int i = 0; i < frames; i++, hand = (hand + 1) % frames)
+            {
+                if (!referenced[hand] && !modified[hand])
+                {
+                    return hand;
+                }
+            }
+            for (int i = 0; i < frames; i++, hand = (hand + 1) % frames)
+            {
+                if (!referenced[hand])
+                {
+                    return hand;
+                }
+                referenced[hand] = 0;
+            }
+        }
+    }
+
+public:
+    SecondChancePolicy(int frames) : frames(frames), pageOf(frames), referenced(frames), modified(frames), where(frames) {}
+
+    std::string name() const override
+    {
+        return "second chance";
+    }
+
+    Access access(std::uint64_t page, bool write) override
+    {
+        std::int64_t frame = where.find(page);
+        if (frame >= 0)
+        {
+            referenced[frame] = 1;
+            modified[frame] |= write;
+            return {true, static_cast<int>(frame), false, 0};
+        }
+        Access result{false, 0, false, 0};
+        if (used < frames)
+        {
+            result.frame = used++;
+        }
+        else
+        {
+            int victim = findVictim();
+            result = {false, victim, true, pageOf[victim]};
+            where.erase(pageOf[victim]);
+            hand = (victim + 1) % frames;
+        }
+        pageOf[result.frame] = page;
+        referenced[result.frame] = 1;
+        modified[result.frame] = write;
+        where.set(page, result.frame);
+        return result;
+    }
+};
+
+// Adaptive replacement cache (Megiddo and Modha): resident pages are split
+// between T1, seen once recently, and T2, seen at least twice, with ghost
+// lists B1 and B2 remembering pages recently evicted from each. A hit in a
+// ghost list moves the target size of T1 towards the list that would have
+// kept the page. Every list is doubly linked through a pool of nodes and
+// found through one hash map, so each reference is O(1).
+class ArcPolicy : public ReplacementPolicy
+{
+    enum ListId
+    {
+        t1,
+        t2,
+        b1,
+        b2
+    };
+
+    struct Node
+    {
+        std::uint64_t page;
+        int previous, next; // towards the most and least recent
+        int list;
+        int frame; // -1 in a ghost list
+    };
+
+    struct List
+    {
+        int head = -1, tail = -1; // most and least recently used
+        int size = 0;
+    };
+
+    int capacity;
+    int target = 0; // the size T1 is steered towards
+    int nextFrame = 0;
+    std::vector<Node> nodes;
+    std::vector<int> freeNodes;
+    List lists[4];
+    PageMap where; // page to node
+
+    void unlink(int n)
+    {
+        Node &node = nodes[n];
+        List &list = lists[node.list];
+        (node.previous >= 0 ? nodes[node.previous].next : list.head) = node.next;
+        (node.next >= 0 ? nodes[node.next].previous : list.tail) = node.previous;
+        list.size--;
+    }
+
+    void pushFront(int listId, int n)
+    {
+        Node &node = nodes[n];
+        List &list = lists[listId];
+        node.list = listId;
+        node.previous = -1;
+        node.next = list.head;
+        (list.head >= 0 ? nodes[list.head].previous : list.tail) = n;
+        list.head = n;
+        list.size++;
+    }
+
+    // Forget the least recent page of a ghost list
+    void dropGhost(int listId)
+    {
+        int n = lists[listId].tail;
+        unlink(n);
+        where.erase(nodes[n].page);
+        freeNodes.push_back(n);
+    }
+
+    // Evict the least recent page of T1 or T2 into its ghost list; returns
+    // the frame it frees
+    int replace(bool inB2, Access &result)
+    {
+        int from = t2;
+        if (lists[t1].size >= 1 && ((inB2 && lists[t1].size == target) || lists[t1].size > target || lists[t2].size == 0))
+        {
+            from = t1;
+        }
+        int n = lists[from].tail;
+        unlink(n);
+        pushFront(from == t1 ? b1 : b2, n);
+        result.evicted = true;
+        result.victim = nodes[n].page;
+        int frame = nodes[n].frame;
+        nodes[n].frame = -1;
+        return frame;
+    }
+
+public:
+    ArcPolicy(int frames) : capacity(frames), where(2 * frames)
+    {
+        nodes.reserve(2 * frames);
+    }
+
+    std::string name() const override
+    {
+        return "ARC";
+    }
+
+    Access access(std::uint64_t page, bool) override
+    {
+        std::int64_t found = where.find(page);
+        if (found >= 0 && (nodes[found].list == t1 || nodes[found].list == t2))
+        {
+            int n = static_cast<int>(found);
+            unlink(n);
+            pushFront(t2, n);
+            return {true, nodes[n].frame, false, 0};
+        }
+
+        Access result{false, 0, false, 0};
+        if (found >= 0)
+        {
+            // A ghost hit: adapt, make room and bring the page back into T2
+            int n = static_cast<int>(found);
+            bool inB2 = nodes[n].list == b2;
+            if (inB2)
+            {
+                target = std::max(0, target - std::max(lists[b1].size / lists[b2].size, 1));
+            }
+            else
+            {
+                target = std::min(capacity, target + std::max(lists[b2].size / lists[b1].size, 1));
+            }
+            result.frame = replace(inB2, result);
+            unlink(n);
+            nodes[n].frame = result.frame;
+            pushFront(t2, n);
+            return result;
+        }
+
+        // A page in no list
+        int l1 = lists[t1].size + lists[b1].size;
+        int total = l1 + lists[t2].size + lists[b2].size;
+        if (l1 == capacity)
+        {
+            if (lists[t1].size < capacity)
+            {
+                dropGhost(b1);
+                result.frame = replace(false, result);
+            }
+            else
+            {
+                // B1 is empty: evict the least recent page of T1 outright
+                int n = lists[t1].tail;
+                result.evicted = true;
+                result.victim = nodes[n].page;
+                result.frame = nodes[n].frame;
+                unlink(n);
+                where.erase(nodes[n].page);
+                freeNodes.push_back(n);
+            }
+        }
+        else if (total >= capacity)
+        {
+            if (total == 2 * capacity)
+            {
+                dropGhost(b2);
+            }
+            result.frame = replace(false, result);
+        }
+        else
+        {
+            result.frame = nextFrame++;
+        }
+
+        int n;
+        if (freeNodes.empty())
+        {
+            n = nodes.size();
+            nodes.emplace_back();
+        }
+        else
+        {
+            n = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        nodes[n].page = page;
+        nodes[n].frame = result.frame;
+        pushFront(t1, n);
+        where.set(page, n);
+        return result;
+    }
+};
+
+// Belady's optimal policy: evict the page whose next use is furthest away.
+// It needs the future, so it runs over a trace held in memory, given the
+// index of each reference's next use of the same page.
+class OptimalPolicy : public ReplacementPolicy
+{
+    int frames;
+    int used = 0;
+    std::shared_ptr<const std::vector<std::uint64_t>> nextUse;
+    std::size_t position = 0;
+    std::vector<std::uint64_t> pageOf, nextOf;
+    std::set<std::pair<std::uint64_t, int>> byNextUse; // resident frames
+    PageMap where;
+
+public:
+    static constexpr std::uint64_t never = ~std::uint64_t(0);
+
+    OptimalPolicy(int frames, std::shared_ptr<const std::vector<std::uint64_t>> nextUse)
+        : frames(frames), nextUse(std::move(nextUse)), pageOf(frames), nextOf(frames), where(frames) {}
+
+    std::string name() const override
+    {
+        return "OPT";
+    }
+
+    Access access(std::uint64_t page, bool) override
+    {
+        std::uint64_t next = (*nextUse)[position++];
+        std::int64_t found = where.find(page);
+        Access result{false, 0, false, 0};
+        if (found >= 0)
+        {
+            result = {true, static_cast<int>(found), false, 0};
+            byNextUse.erase({nextOf[found], result.frame});
+        }
+        else if (used < frames)
+        {
+            result.frame = used++;
+        }
+        else
+        {
+            auto furthest = std::prev(byNextUse.end());
+            result = {false, furthest->second, true, pageOf[furthest->second]};
+            byNextUse.erase(furthest);
+            where.erase(result.victim);
+        }
+        if (!result.hit)
+        {
+            pageOf[result.frame] = page;
+            where.set(page, result.frame);
+        }
+        nextOf[result.frame] = next;
+        byNextUse.insert({next, result.frame});
+        return result;
+    }
+};
+
+// Page keys, combining a process and a virtual page number into the one
+// number the replacement policies see. A pair that fits is packed, the
+// process above the low 40 bits; any other is numbered from 2^63 up and
+// remembered, so distinct pages never share a key and no key is
+// PageMap's empty one.
+class PageKeys
+{
+    static const int pageBits = 40;
+    static const int processBits = 23;
+    static constexpr std::uint64_t numbered = std::uint64_t(1) << 63;
+
+    std::map<std::pair<std::uint32_t, std::uint64_t>, std::uint64_t> numbers;
+    std::vector<std::pair<std::uint32_t, std::uint64_t>> pages; // by number less 2^63
+
+public:
+    std::uint64_t key(std::uint32_t process, std::uint64_t vpage)
+    {
+        if (process >> processBits == 0 && vpage >> pageBits == 0)
+        {
+            return static_cast<std::uint64_t>(process) << pageBits | vpage;
+        }
+        auto found = numbers.emplace(std::make_pair(process, vpage), numbered | pages.size());
+        if (found.second)
+        {
+            pages.emplace_back(process, vpage);
+        }
+        return found.first->second;
+    }
+
+    std::uint32_t process(std::uint64_t key) const
+    {
+        return key & numbered ? pages[key & ~numbered].first : static_cast<std::uint32_t>(key >> pageBits);
+    }
+
+    std::uint64_t vpage(std::uint64_t key) const
+    {
+        return key & numbered ? pages[key & ~numbered].second : key & ((std::uint64_t(1) << pageBits) - 1);
+    }
+};
+
+// Function to work out, for each reference of a trace held in memory, the
+// index of the next reference to the same page
+std::vector<std::uint64_t> nextUses(const std::vector<Reference> &trace, int pageSize)
+{
+    std::vector<std::uint64_t> next(trace.size());
+    PageMap last;
+    PageKeys keys;
+    for (std::size_t i = trace.size(); i-- > 0;)
+    {
+        std::uint64_t page = keys.key(trace[i].process, trace[i].address / pageSize);
+        std::int64_t found = last.find(page);
+        next[i] = found >= 0 ? static_cast<std::uint64_t>(found) : OptimalPolicy::never;
+        last.set(page, static_cast<std::int64_t>(i));
+    }
+    return next;
+}
+
+// How the TLB picks an entry to replace within a set
+enum class TlbReplacement
+{
+    lru,
+    fifo,
+    random
+};
+
+// Options for address translation
+struct TranslationOptions
+{
+    int levels = 4;       // page table levels, 2 to 4
+    int addressBits = 32; // width of a virtual address
+    int tlbEntries = 64;
+    int tlbWays = 4;
+    TlbReplacement tlbReplacement = TlbReplacement::lru;
+    bool hugePages = false;
+    double tlbNanos = 1;      // time of a TLB lookup
+    double memoryNanos = 100; // time of a memory access, and of each page walk step
+};
+
+// Multi-level page tables for every process. A virtual page number is
+// split into one index per level, the top level taking any bits left
+// over; tables are allocated when the first page under them is mapped and
+// freed when the last one is unmapped.
+//
+// With huge pages, a last-level table whose entries are all mapped is
+// collapsed into a single huge mapping in its parent, as a kernel
+// collapses a fully populated region: walks then stop one level early and
+// one TLB entry covers the whole region. Unmapping any page of the region
+// splits it again. Frames are not really moved to be contiguous; only the
+// cost of translation is modelled.
+class PageTables
+{
+    struct Table
+    {
+        std::vector<std::uint64_t> entries; // 0 if not present
+        int used = 0;
+    };
+
+    // An entry of an upper table holds child + 1 shifted left once, with
+    // the low bit set for a huge mapping; a last-level entry holds frame + 1
+    static const std::uint64_t hugeBit = 1;
+
+    std::vector<int> bits;   // index bits per level, top first
+    std::vector<int> shifts; // bits of the page number below each level's index
+    int pageBits = 0;        // bits of a virtual page number
+    bool hugePages;
+    std::vector<Table> tables;
+    std::vector<int> freeTables;
+    PageMap roots; // process to its top-level table
+    long long liveBytes = 0;
+    long long peakBytes = 0;
+
+    int index(std::uint64_t vpage, int level) const
+    {
+        return static_cast<int>(vpage >> shifts[level] & ((std::uint64_t(1) << bits[level]) - 1));
+    }
+
+    int newTable(int level)
+    {
+        int table;
+        if (freeTables.empty())
+        {
+            table = static_cast<int>(tables.size());
+            tables.emplace_back();
+        }
+        else
+        {
+            table = freeTables.back();
+            freeTables.pop_back();
+        }
+        tables[table].entries.assign(std::size_t(1) << bits[level], 0);
+        tables[table].used = 0;
+        liveBytes += tables[table].entries.size() * sizeof(std::uint64_t);
+        peakBytes = std::max(peakBytes, liveBytes);
+        return table;
+    }
+
+public:
+    // What a page walk found
+    struct Walk
+    {
+        bool present;
+        bool huge;
+        int steps; // table entries read
+    };
+
+    PageTables(int levels, int addressBits, int pageSize, bool hugePages) : hugePages(hugePages)
+    {
+        pageBits = addressBits - __builtin_ctz(pageSize);
+        for (int level = 0; level < levels; level++)
+        {
+            bits.push_back(pageBits / levels + (level == 0 ? pageBits % levels : 0));
+        }
+        shifts.resize(levels);
+        for (int level = levels - 2; level >= 0; level--)
+        {
+            shifts[level] = shifts[level + 1] + bits[level + 1];
+        }
+    }
+
+    int levels() const
+    {
+        return static_cast<int>(bits.size());
+    }
+
+    // Whether a virtual page number fits in the address space
+    bool contains(std::uint64_t vpage) const
+    {
+        return vpage >> pageBits == 0;
+    }
+
+    // Base pages covered by a huge page, as a power of two
+    int hugeShift() const
+    {
+        return bits.back();
+    }
+
+    // Bytes held by tables at the most
+    long long peakTableBytes() const
+    {
+        return peakBytes;
+    }
+
+    Walk walk(std::uint32_t process, std::uint64_t vpage) const
+    {
+        std::int64_t table = roots.find(process);
+        if (table < 0)
+        {
+            return {false, false, 1};
+        }
+        for (int level = 0;; level++)
+        {
+            std::uint64_t entry = tables[table].entries[index(vpage, level)];
+            if (entry == 0 || level == levels() - 1)
+            {
+                return {entry != 0, false, level + 1};
+            }
+            if (entry & hugeBit)
+            {
+                return {true, true, level + 1};
+            }
+            table = static_cast<std::int64_t>(entry >> 1) - 1;
+        }
+    }
+
+    // Map a virtual page to a frame; true if this completed a region that
+    // was collapsed into a huge page
+    bool map(std::uint32_t process, std::uint64_t vpage, int frame)
+    {
+        std::int64_t root = roots.find(process);
+        if (root < 0)
+        {
+            root = newTable(0);
+            roots.set(process, root);
+        }
+        int table = static_cast<int>(root), parent = -1;
+        for (int level = 0; level < levels() - 1; level++)
+        {
+            std::uint64_t &entry = tables[table].entries[index(vpage, level)];
+            if (entry == 0)
+            {
+                int child = newTable(level + 1);
+                // Adding a table may have moved the others; find the entry again
+                tables[table].entries[index(vpage, level)] = static_cast<std::uint64_t>(child + 1) << 1;
+                tables[table].used++;
+                parent = table;
+                table = child;
+                continue;
+            }
+            parent = table;
+            table = static_cast<int>(entry >> 1) - 1;
+        }
+        std::uint64_t &leaf = tables[table].entries[index(vpage, levels() - 1)];
+        if (leaf == 0)
+        {
+            tables[table].used++;
+        }
+        leaf = static_cast<std::uint64_t>(frame) + 1;
+        if (hugePages && tables[table].used == static_cast<int>(tables[table].entries.size()))
+        {
+            tables[parent].entries[index(vpage, levels() - 2)] |= hugeBit;
+            return true;
+        }
+        return false;
+    }
+
+    // Unmap a virtual page, freeing tables left empty; true if this split
+    // a huge page
+    bool unmap(std::uint32_t process, std::uint64_t vpage)
+    {
+        std::int64_t root = roots.find(process);
+        if (root < 0)
+        {
+            return false;
+        }
+        std::vector<int> path(levels());
+        path[0] = static_cast<int>(root);
+        for (int level = 0; level < levels() - 1; level++)
+        {
+            std::uint64_t entry = tables[path[level]].entries[index(vpage, level)];
+            if (entry == 0)
+            {
+                return false;
+            }
+            path[level + 1] = static_cast<int>(entry >> 1) - 1;
+        }
+        std::uint64_t &leaf = tables[path.back()].entries[index(vpage, levels() - 1)];
+        if (leaf == 0)
+        {
+            return false;
+        }
+        leaf = 0;
+        tables[path.back()].used--;
+
+        std::uint64_t &parentEntry = tables[path[levels() - 2]].entries[index(vpage, levels() - 2)];
+        bool split = parentEntry & hugeBit;
+        parentEntry &= ~hugeBit;
+
+        for (int level = levels() - 1; level >= 0 && tables[path[level]].used == 0; level--)
+        {
+            freeTables.push_back(path[level]);
+            liveBytes -= tables[path[level]].entries.size() * sizeof(std::uint64_t);
+            if (level == 0)
+            {
+                roots.erase(process);
+            }
+            else
+            {
+                tables[path[level - 1]].entries[index(vpage, level - 1)] = 0;
+                tables[path[level - 1]].used--;
+            }
+        }
+        return split;
+    }
+};
+
+// A set-associative TLB. Entries are tagged with the process, so a switch
+// between processes needs no flush.
+class Tlb
+{
+public:
+    // Keys hold the process, and a page or huge page number shifted left
+    // once with the low bit set for a huge page
+    struct Key
+    {
+        std::uint32_t process;
+        std::uint64_t page;
+    };
+
+private:
+    int sets;
+    int ways;
+    TlbReplacement replacement;
+    std::vector<Key> tags;             // key with page + 1 by set and way, page 0 if empty
+    std::vector<std::uint64_t> stamps; // last use for LRU, fill time for FIFO
+    std::uint64_t clock = 0;
+    std::mt19937_64 rng;
+
+    std::size_t setOf(const Key &key) const
+    {
+        // Low virtual page bits, mixed with the process
+        return ((key.page >> 1) ^ key.process) % sets * ways;
+    }
+
+    bool holds(std::size_t way, const Key &key) const
+    {
+        return tags[way].page == key.page + 1 && tags[way].process == key.process;
+    }
+
+public:
+    Tlb(int entries, int ways, TlbReplacement replacement)
+        : sets(entries / ways), ways(ways), replacement(replacement), tags(entries), stamps(entries), rng(1) {}
+
+    static Key key(std::uint32_t process, std::uint64_t vpage, bool huge)
+    {
+        return {process, vpage << 1 | huge};
+    }
+
+    bool lookup(const Key &key)
+    {
+        std::size_t first = setOf(key);
+        clock++;
+        for (std::size_t way = first; way < first + ways; way++)
+        {
+            if (holds(way, key))
+            {
+                if (replacement == TlbReplacement::lru)
+                {
+                    stamps[way] = clock;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void insert(const Key &key)
+    {
+        std::size_t first = setOf(key);
+        std::size_t victim = first;
+        for (std::size_t way = first; way < first + ways; way++)
+        {
+            if (tags[way].page == 0)
+            {
+                victim = way;
+                break;
+            }
+            if (stamps[way] < stamps[victim])
+            {
+                victim = way;
+            }
+        }
+        if (tags[victim].page != 0 && replacement == TlbReplacement::random)
+        {
+            victim = first + rng() % ways;
+        }
+        tags[victim] = {key.process, key.page + 1};
+        stamps[victim] = clock;
+    }
+
+    void invalidate(const Key &key)
+    {
+        std::size_t first = setOf(key);
+        for (std::size_t way = first; way < first + ways; way++)
+        {
+            if (holds(way, key))
+            {
+                tags[way].page = 0;
+            }
+        }
+    }
+};
+
+// What translation cost over a run
+struct TranslationStats
+{
+    std::uint64_t lookups = 0; // a faulting reference is looked up again
+    std::uint64_t tlbHits = 0;
+    std::uint64_t walks = 0;
+    std::uint64_t walkSteps = 0;
+    std::uint64_t promotions = 0; // regions collapsed into huge pages
+    std::uint64_t splits = 0;     // huge pages split again
+};
+
+// Address translation: a TLB in front of multi-level page tables. The
+// paging simulator maps a page when it loads it and unmaps it, removing it
+// from the TLB, when it evicts it.
+class Mmu
+{
+    TranslationOptions options;
+    int pageSize;
+    PageTables tables;
+    Tlb tlb;
+
+public:
+    TranslationStats stats;
+    std::string error; // set when the options or an address are invalid
+
+    Mmu(const TranslationOptions &options, int pageSize)
+        : options(options), pageSize(pageSize), tables(options.levels, options.addressBits, pageSize, options.hugePages),
+          tlb(options.tlbEntries, options.tlbWays, options.tlbReplacement)
+    {
+        int pageBits = options.addressBits - __builtin_ctz(pageSize);
+        if ((pageSize & (pageSize - 1)) != 0)
+        {
+            error = "translation needs a power-of-two page size";
+        }
+        else if (options.levels < 2 || options.levels > 4 || pageBits < options.levels || pageBits > 40)
+        {
+            error = "a " + std::to_string(options.addressBits) + "-bit address space cannot be split into " +
+                    std::to_string(options.levels) + " levels of " + std::to_string(pageSize) + " B pages";
+        }
+        else if (options.tlbWays <= 0 || options.tlbEntries < options.tlbWays || options.tlbEntries % options.tlbWays != 0)
+        {
+            error = "TLB entries must be a multiple of its ways";
+        }
+    }
+
+    // Translate a reference, walking the page tables on a TLB miss; false
+    // if the page is not mapped or the address is out of range
+    bool translate(const Reference &reference)
+    {
+        std::uint64_t vpage = reference.address / pageSize;
+        if (!tables.contains(vpage))
+        {
+            error = "address " + std::to_string(reference.address) + " is beyond a " +
+                    std::to_string(options.addressBits) + "-bit address space";
+            return false;
+        }
+        stats.lookups++;
+        if (tlb.lookup(Tlb::key(reference.process, vpage, false)) ||
+            (options.hugePages && tlb.lookup(Tlb::key(reference.process, vpage >> tables.hugeShift(), true))))
+        {
+            stats.tlbHits++;
+            return true;
+        }
+        PageTables::Walk walk = tables.walk(reference.process, vpage);
+        stats.walks++;
+        stats.walkSteps += walk.steps;
+        if (walk.present)
+        {
+            tlb.insert(walk.huge ? Tlb::key(reference.process, vpage >> tables.hugeShift(), true)
+                                 : Tlb::key(reference.process, vpage, false));
+        }
+        return walk.present;
+    }
+
+    void map(std::uint32_t process, std::uint64_t vpage, int frame)
+    {
+        if (tables.map(process, vpage, frame))
+        {
+            stats.promotions++;
+        }
+    }
+
+    void unmap(std::uint32_t process, std::uint64_t vpage)
+    {
+        if (tables.unmap(process, vpage))
+        {
+            stats.splits++;
+            tlb.invalidate(Tlb::key(process, vpage >> tables.hugeShift(), true));
+        }
+        tlb.invalidate(Tlb::key(process, vpage, false));
+    }
+
+    // Mean time of a memory reference: the TLB lookups and page walk steps
+    // it needed, then the access itself. Time spent handling faults is not
+    // counted.
+    double effectiveAccessNanos(std::uint64_t references) const
+    {
+        if (references == 0)
+        {
+            return 0;
+        }
+        return options.memoryNanos + (stats.lookups * options.tlbNanos + stats.walkSteps * options.memoryNanos) / references;
+    }
+
+    long long peakTableBytes() const
+    {
+        return tables.peakTableBytes();
+    }
+};
+
+// What a run of the virtual memory simulator counted
+struct PagingStats
+{
+    std::uint64_t references = 0;
+    std::uint64_t faults = 0;
+    std::uint64_t zeroFills = 0; // faults on pages never written out
+    std::uint64_t swapIns = 0;   // faults read back from swap
+    std::uint64_t swapOuts = 0;  // dirty pages written to swap on eviction
+    double seconds = 0;
+};
+
+// Function to run references through a replacement policy. Each fault
+// loads the page from swap if it was written there, or zero-fills it; an
+// evicted page is written to swap only if it was modified since loading.
+// Given an MMU, every reference is also translated, and a faulting one
+// translated again once its page is loaded, as the retried access would be.
+PagingStats simulatePaging(ReferenceSource &source, ReplacementPolicy &policy, int frames, int pageSize, Mmu *mmu = nullptr)
+{
+    PagingStats stats;
+    std::vector<char> dirty(frames);
+    PageMap swapped; // pages with a copy in swap
+    PageKeys keys;
+    auto start = std::chrono::steady_clock::now();
+    Reference reference;
+    while (source.next(reference))
+    {
+        if (mmu && !mmu->translate(reference) && !mmu->error.empty())
+        {
+            break;
+        }
+        std::uint64_t vpage = reference.address / pageSize;
+        std::uint64_t page = keys.key(reference.process, vpage);
+        Access result = policy.access(page, reference.write);
+        stats.references++;
+        if (!result.hit)
+        {
+            stats.faults++;
+            if (result.evicted && dirty[result.frame])
+            {
+                stats.swapOuts++;
+                swapped.set(result.victim, 1);
+            }
+            if (swapped.find(page) >= 0)
+            {
+                stats.swapIns++;
+            }
+            else
+            {
+                stats.zeroFills++;
+            }
+            dirty[result.frame] = 0;
+            if (mmu)
+            {
+                if (result.evicted)
+                {
+                    mmu->unmap(keys.process(result.victim), keys.vpage(result.victim));
+                }
+                mmu->map(reference.process, vpage, result.frame);
+                mmu->translate(reference);
+            }
+        }
+        dirty[result.frame] |= reference.write;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats.seconds = elapsed.count();
+    return stats;
+}
+
+// A source replaying a trace held in memory
+class ReplayReferences : public ReferenceSource
+{
+    const std::vector<Reference> &trace;
+    std::size_t position = 0;
+
+public:
+    ReplayReferences(const std::vector<Reference> &trace) : trace(trace) {}
+
+    bool next(Reference &reference) override
+    {
+        if (position == trace.size())
+        {
+            return false;
+        }
+        reference = trace[position++];
+        return true;
+    }
+};
+
+// Options for the virtual memory simulator
+struct PagingOptions
+{
+    std::string trace; // empty to generate references
+    LocalityModel model = LocalityModel::workingSet;
+    std::uint64_t references = 1000000;
+    int processes = 8;
+    int pageSize = 1024;
+    int frames = MEMORY_SIZE / 1024;
+    std::vector<std::string> policies = {"fifo", "lru", "clock", "second-chance", "arc", "opt"};
+    std::uint64_t seed = 1;
+    bool translate = false; // also model the TLB and page tables
+    TranslationOptions translation;
+};
+
+// Function to print what translation cost over a run
+void printTranslation(const std::string &label, const Mmu &mmu, const TranslationOptions &options, std::uint64_t references)
+{
+    const TranslationStats &stats = mmu.stats;
+    std::cout << label << ": TLB hit rate: " << 100.0 * stats.tlbHits / std::max<std::uint64_t>(stats.lookups, 1)
+              << "%, page walks: " << stats.walks << ", walk steps: " << stats.walkSteps
+              << ", effective access time: " << mmu.effectiveAccessNanos(references) << " ns";
+    if (options.hugePages)
+    {
+        std::cout << ", huge page promotions: " << stats.promotions << ", splits: " << stats.splits;
+    }
+    std::cout << ", page table bytes at peak: " << mmu.peakTableBytes() << std::endl;
+}
+
+// Function to open the references a run reads: the trace file, or a fresh
+// generator with the same seed, so every policy sees the same references
+std::unique_ptr<ReferenceSource> openReferences(const PagingOptions &options)
+{
+    if (!options.trace.empty())
+    {
+        return std::make_unique<TraceReferences>(options.trace);
+    }
+    return std::make_unique<GeneratedReferences>(options.model, options.references, options.processes, options.pageSize, options.seed);
+}
+
+// Function to run every chosen replacement policy over the references and
+// report the fault rate, swap traffic and references simulated per second
+int runPaging(const PagingOptions &options)
+{
+    for (const std::string &name : options.policies)
+    {
+        std::unique_ptr<ReplacementPolicy> policy;
+        std::unique_ptr<ReferenceSource> source = openReferences(options);
+        std::vector<Reference> trace;
+        if (name == "opt")
+        {
+            // The optimal policy reads the whole trace ahead of time
+            Reference reference;
+            while (source->next(reference))
+            {
+                trace.push_back(reference);
+            }
+            if (!source->error.empty())
+            {
+                std::cerr << "Error: " << source->error << std::endl;
+                return 1;
+            }
+            auto next = std::make_shared<const std::vector<std::uint64_t>>(nextUses(trace, options.pageSize));
+            policy = std::make_unique<OptimalPolicy>(options.frames, next);
+            source = std::make_unique<ReplayReferences>(trace);
+        }
+        else if (name == "fifo")
+        {
+            policy = std::make_unique<FifoPolicy>(options.frames);
+        }
+        else if (name == "lru")
+        {
+            policy = std::make_unique<LruPolicy>(options.frames);
+        }
+        else if (name == "clock")
+        {
+            policy = std::make_unique<ClockPolicy>(options.frames);
+        }
+        else if (name == "second-chance")
+        {
+            policy = std::make_unique<SecondChancePolicy>(options.frames);
+        }
+        else
+        {
+            policy = std::make_unique<ArcPolicy>(options.frames);
+        }
+
+        std::unique_ptr<Mmu> mmu;
+        if (options.translate)
+        {
+            mmu = std::make_unique<Mmu>(options.translation, options.pageSize);
+            if (!mmu->error.empty())
+            {
+                std::cerr << "Error: " << mmu->error << std::endl;
+                return 1;
+            }
+        }
+
+        PagingStats stats = simulatePaging(*source, *policy, options.frames, options.pageSize, mmu.get());
+        std::string error = mmu && !mmu->error.empty() ? mmu->error : source->error;
+        if (!error.empty())
+        {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        double references = std::max<std::uint64_t>(stats.references, 1);
+        std::cout << policy->name() << ": references: " << stats.references << ", faults: " << stats.faults
+                  << " (" << 100.0 * stats.faults / references << "%), zero-fill: " << stats.zeroFills
+                  << ", swap-ins: " << stats.swapIns << ", swap-outs: " << stats.swapOuts
+                  << ", references per second: " << static_cast<std::uint64_t>(stats.references / std::max(stats.seconds, 1e-9))
+                  << std::endl;
+        if (mmu)
+        {
+            printTranslation("  translation", *mmu, options.translation, stats.references);
+        }
+    }
+    return 0;
+}
+
+// Function to report translation costs for one page size. Every page size
+// sees the same byte addresses, generated at the finest grain of the
+// sweep, and memory holds MEMORY_SIZE in pages of that size under LRU.
+void runTranslation(int pageSize, int grain, const TranslationOptions &options)
+{
+    const std::uint64_t references = 1000000;
+    Mmu mmu(options, pageSize);
+    if (!mmu.error.empty())
+    {
+        std::cerr << "Error: " << mmu.error << std::endl;
+        return;
+    }
+    int frames = std::max(1, MEMORY_SIZE / pageSize);
+    GeneratedReferences source(LocalityModel::workingSet, references, 8, grain, 1);
+    LruPolicy policy(frames);
+    PagingStats stats = simulatePaging(source, policy, frames, pageSize, &mmu);
+    if (!mmu.error.empty())
+    {
+        std::cerr << "Error: " << mmu.error << std::endl;
+        return;
+    }
+    printTranslation("translation (" + std::to_string(pageSize) + " B pages, " + std::to_string(options.levels) + " levels)",
+                     mmu, options, stats.references);
+}
+
+// Function to apply a translation option; false if option is not one, or
+// its value is invalid
+bool parseTranslationOption(const std::string &option, const std::string &value, TranslationOptions &options)
+{
+    if (option == "--levels")
+    {
+        options.levels = std::atoi(value.c_str());
+        return options.levels >= 2 && options.levels <= 4;
+    }
+    if (option == "--address-bits")
+    {
+        options.addressBits = std::atoi(value.c_str());
+        return options.addressBits > 0 && options.addressBits <= 64;
+    }
+    if (option == "--tlb-entries")
+    {
+        options.tlbEntries = std::atoi(value.c_str());
+        return options.tlbEntries > 0;
+    }
+    if (option == "--tlb-ways")
+    {
+        options.tlbWays = std::atoi(value.c_str());
+        return options.tlbWays > 0;
+    }
+    if (option == "--tlb-policy" && (value == "lru" || value == "fifo" || value == "random"))
+    {
+        options.tlbReplacement = value == "fifo" ? TlbReplacement::fifo : value == "random" ? TlbReplacement::random : TlbReplacement::lru;
+        return true;
+    }
+    if (option == "--huge-pages" && (value == "on" || value == "off"))
+    {
+        options.hugePages = value == "on";
+        return true;
+    }
+    return false;
+}
+
+// Function to run one pattern of allocations against the arena and the
+// system malloc, reporting operations per second and the latency of single
+// operations. Threads share a table of blocks: an operation picks a slot
+// at random and frees its block, often one another thread allocated, or
+// allocates one into it if it is empty. Sizes are mostly small, with some
+// medium and a few beyond the arena's size classes.
+void runArena(int threads, std::uint64_t operations)
+{
+    const std::size_t slotsPerThread = 1024;
+    ArenaAllocator arena(std::size_t(1) << 30);
+    const std::pair<const char *, std::pair<std::function<void *(std::size_t)>, std::function<void(void *)>>> allocators[] = {
+        {"arena", {[&](std::size_t size)
+                   { return arena.allocate(size); },
+                   [&](void *pointer)
+                   { arena.free(pointer); }}},
+        {"malloc", {[](std::size_t size)
+                    { return std::malloc(size); },
+                    [](void *pointer)
+                    { std::free(pointer); }}},
+    };
+    for (const auto &allocator : allocators)
+    {
+        const auto &allocate = allocator.second.first;
+        const auto &release = allocator.second.second;
+        std::vector<std::atomic<void *>> slots(slotsPerThread * threads);
+        std::vector<std::vector<std::uint32_t>> latencies(threads);
+        std::atomic<bool> failed{false};
+
+        auto work = [&](int thread)
+        {
+            std::mt19937_64 rng(thread + 1);
+            std::vector<std::uint32_t> &samples = latencies[thread];
+            samples.reserve(operations / threads);
+            for (std::uint64_t i = thread; i < operations; i += threads)
+            {
+                std::size_t slot = rng() % slots.size();
+                int kind = rng() % 100;
+                std::size_t size = kind < 90 ? 16 + rng() % 497 : kind < 99 ? 512 + rng() % 7681 : 8192 + rng() % 57345;
+                auto start = std::chrono::steady_clock::now();
+                void *block = slots[slot].exchange(nullptr, std::memory_order_acq_rel);
+                if (block)
+                {
+                    release(block);
+                }
+                else
+                {
+                    block = allocate(size);
+                    if (!block)
+                    {
+                        failed = true;
+                    }
+                    else
+                    {
+                        // Touch the block, as its owner would
+                        static_cast<char *>(block)[0] = 1;
+                        void *empty = nullptr;
+                        if (!slots[slot].compare_exchange_strong(empty, block, std::memory_order_acq_rel))
+                        {
+                            release(block);
+                        }
+                    }
+                }
+                std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+                samples.push_back(static_cast<std::uint32_t>(std::min(elapsed.count(), 4e9)));
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int thread = 0; thread < threads; thread++)
+        {
+            workers.emplace_back(work, thread);
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        for (std::atomic<void *> &slot : slots)
+        {
+            release(slot.load());
+        }
+
+        std::vector<std::uint32_t> all;
+        for (const std::vector<std::uint32_t> &samples : latencies)
+        {
+            all.insert(all.end(), samples.begin(), samples.end());
+        }
+        std::sort(all.begin(), all.end());
+        auto percentile = [&](double fraction)
+        {
+            return all.empty() ? 0 : all[std::min(all.size() - 1, static_cast<std::size_t>(fraction * all.size()))];
+        };
+        std::cout << allocator.first << ": threads: " << threads << ", operations: " << all.size()
+                  << ", operations per second: " << static_cast<std::uint64_t>(all.size() / std::max(elapsed.count(), 1e-9))
+                  << ", latency ns p50: " << percentile(0.5) << ", p99: " << percentile(0.99) << ", p99.9: " << percentile(0.999)
+                  << ", max: " << (all.empty() ? 0 : all.back()) << (failed ? " (ran out of memory)" : "") << std::endl;
+    }
+}
+
+// Usage: MemoryManagement [--vm [--trace file] [--model working-set|loop|random]
+//                         [--references n] [--processes n] [--page-size bytes]
+//                         [--frames n] [--policy fifo|lru|clock|second-chance|arc|opt]
+//                         [--seed n]] [translation options]
+//        MemoryManagement --arena [--threads n] [--operations n]
+// Translation options: [--levels 2|3|4] [--address-bits n] [--tlb-entries n]
+//                      [--tlb-ways n] [--tlb-policy lru|fifo|random] [--huge-pages on|off]
+//   Without --vm, compares the allocators on random requests, then reports
+//   the TLB and page walk costs of each page size. With it, simulates
+//   virtual memory over a reference trace, or over references generated
+//   with the chosen locality model, under every replacement policy or the
+//   one given; translation options also report translation costs there.
+//   Frames default to MEMORY_SIZE in pages. --arena compares the arena
+//   allocator with malloc on threads sharing blocks, four threads and
+//   four million operations by default.
+int main(int argc, char *argv[])
+{
+    const char *usage[] = {
+        " [--vm [--trace file] [--model working-set|loop|random] [--references n]",
+        "       [--processes n] [--page-size bytes] [--frames n]",
+        "       [--policy fifo|lru|clock|second-chance|arc|opt] [--seed n]]",
+        "       [--levels 2|3|4] [--address-bits n] [--tlb-entries n] [--tlb-ways n]",
+        "       [--tlb-policy lru|fifo|random] [--huge-pages on|off]",
+        " --arena [--threads n] [--operations n]",
+    };
+
+    if (argc > 1 && std::string(argv[1]) == "--arena")
+    {
+        int threads = 4;
+        std::uint64_t operations = 4000000;
+        bool valid = argc % 2 == 0;
+        for (int i = 2; valid && i + 1 < argc; i += 2)
+        {
+            std::string option = argv[i], value = argv[i + 1];
+            if (option == "--threads")
+            {
+                threads = std::atoi(value.c_str());
+                valid = threads > 0;
+            }
+            else if (option == "--operations")
+            {
+                operations = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        if (!valid)
+        {
+            std::cerr << "Usage: " << argv[0];
+            for (const char *line : usage)
+            {
+                std::cerr << line << std::endl;
+            }
+            return 1;
+        }
+        runArena(threads, operations);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--vm")
+    {
+        PagingOptions options;
+        int frames = 0;
+        bool valid = argc % 2 == 0;
+        for (int i = 2; valid && i + 1 < argc; i += 2)
+        {
+            std::string option = argv[i], value = argv[i + 1];
+            if (option == "--trace")
+            {
+                options.trace = value;
+            }
+            else if (option == "--model" && (value == "working-set" || value == "loop" || value == "random"))
+            {
+                options.model = value == "loop" ? LocalityModel::loop : value == "random" ? LocalityModel::random : LocalityModel::workingSet;
+            }
+            else if (option == "--references")
+            {
+                options.references = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (option == "--processes")
+            {
+                options.processes = std::atoi(value.c_str());
+                valid = options.processes > 0;
+            }
+            else if (option == "--page-size")
+            {
+                options.pageSize = std::atoi(value.c_str());
+                valid = options.pageSize > 0;
+            }
+            else if (option == "--frames")
+            {
+                frames = std::atoi(value.c_str());
+                valid = frames > 0;
+            }
+            else if (option == "--policy" && std::find(options.policies.begin(), options.policies.end(), value) != options.policies.end())
+            {
+                options.policies = {value};
+            }
+            else if (option == "--seed")
+            {
+                options.seed = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else
+            {
+                valid = parseTranslationOption(option, value, options.translation);
+                options.translate = true;
+            }
+        }
+        if (!valid)
+        {
+            std::cerr << "Usage: " << argv[0];
+            for (const char *line : usage)
+            {
+                std::cerr << line << std::endl;
+            }
+            return 1;
+        }
+        options.frames = frames > 0 ? frames : std::max(1, MEMORY_SIZE / options.pageSize);
+        return runPaging(options);
+    }
+
+    TranslationOptions translation;
+    bool valid = argc % 2 == 1;
+    for (int i = 1; valid && i + 1 < argc; i += 2)
+    {
+        valid = parseTranslationOption(argv[i], argv[i + 1], translation);
+    }
+    if (!valid)
+    {
+        std::cerr << "Usage: " << argv[0];
+        for (const char *line : usage)
+        {
+            std::cerr << line << std::endl;
+        }
+        return 1;
+    }
+
+    srand(time(0));
+    std::vector<int> pageSizes = {128, 256, 512, 1024};
+
+    // Every allocator sees the same requests
+    int numRequests = 1000;
+    std::vector<Request> requests;
+    for (int i = 0; i < numRequests; i++)
+    {
+        int requestSize = rand() % (MAX_REQUEST_SIZE - MIN_REQUEST_SIZE + 1) + MIN_REQUEST_SIZE;
+        int persistence = rand() % 10 + 1;
+
+        requests.push_back({i, requestSize, persistence});
+    }
+
+    for (int pageSize : pageSizes)
+    {
+        runExperiment([&]()
+                      { return std::make_unique<PagingAllocator>(pageSize, MEMORY_SIZE); }, requests);
+    }
+    runExperiment([]()
+                  { return std::make_unique<BuddyAllocator>(MEMORY_SIZE); }, requests);
+    runExperiment([]()
+                  { return std::make_unique<SlabAllocator>(MEMORY_SIZE); }, requests);
+    runExperiment([]()
+                  { return std::make_unique<SegregatedFitAllocator>(MEMORY_SIZE, false); }, requests);
+    runExperiment([]()
+                  { return std::make_unique<SegregatedFitAllocator>(MEMORY_SIZE, true); }, requests);
+
+    for (int pageSize : pageSizes)
+    {
+        runTranslation(pageSize, pageSizes.front(), translation);
     }
 
     return 0;
@@ -152,4 +152,6 @@ int main()
     {
         thr2.join();
     }
+
+    return 0;
 }
\ No newline at end of file
@@ -1,20 +1,47 @@
 #include <iostream>
 #include <algorithm>
 #include <deque>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <map>
+#include <set>
+#include <functional>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <charconv>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 using namespace std;
 
 // Define a structure to represent a process
 struct Process
 {
-    int arrival_time; // The time at which the process arrives
-    int burst_time;   // The amount of time required by the process to complete
-    int start_time;   // The time at which the process starts execution
-    int finish_time;  // The time at which the process finishes execution
+    long long arrival_time = 0;   // The time at which the process arrives
+    long long burst_time = 0;     // The amount of time required by the process to complete
+    long long start_time = 0;     // The time at which the process starts execution
+    long long finish_time = 0;    // The time at which the process finishes execution
+    long long remaining_time = 0; // The amount of execution still owed to the process
+    int priority = 0;             // The priority given by the workload
+    long long id = 0;             // The position of the process in the workload
+    int last_core = 0;            // The core the process last ran on, or -1
+    int level = 0;                // The feedback queue the process belongs to
 };
 
 // Define an array of structures to store the arrival and burst times for each process
-Process processes[] = {
+const Process processes[] = {
     {1, 20},
     {5, 5},
     {18, 36},
@@ -43,138 +70,2052 @@ Process processes[] = {
     {310, 5},
     {315, 25}};
 
-// Define a function to find the index of the process with minimum service time in the ready queue
-int find_min_time_process_index(deque<Process> readyProcess)
+// Define an interface for a scheduling policy. A policy owns the ready queue:
+// the engine hands it processes as they become ready and asks it which one to
+// run next, for how long, and whether a newly ready process should take the
+// CPU away from the running one. Processes are identified by their slot in
+// the engine's table of live processes; a slot is reused once its process
+// has finished.
+class Policy
 {
-    int n = readyProcess.size();
-    int min_service_time = readyProcess[0].burst_time;
-    int min_service_time_process_index = 0;
-    for (int i = 1; i < n; i++)
+public:
+    virtual ~Policy() {}
+
+    // The process becomes ready: it arrived, or it was preempted
+    virtual void add(int process, const vector<Process> &workload, long long now) = 0;
+
+    // Return the process to run next without removing it; only called when
+    // not empty
+    virtual int peek(const vector<Process> &workload, long long now) = 0;
+
+    // Remove and return the process to run next; only called when not empty
+    virtual int pick(const vector<Process> &workload, long long now) = 0;
+
+    virtual bool empty() const = 0;
+
+    // How long the process may run before it goes back to the ready queue;
+    // LLONG_MAX when it runs until it finishes
+    virtual long long time_slice(const Process &) const
+    {
+        return LLONG_MAX;
+    }
+
+    // Whether the ready queue now holds a process that should preempt the
+    // running one
+    virtual bool preempts(int, const vector<Process> &)
+    {
+        return false;
+    }
+
+    // The process used up its whole time slice without finishing
+    virtual void expired(Process &) {}
+};
+
+// Define a policy for first-come first-served (FIFO) scheduling
+class FcfsPolicy : public Policy
+{
+public:
+    void add(int process, const vector<Process> &, long long) override
+    {
+        ready.push_back(process);
+    }
+
+    int peek(const vector<Process> &, long long) override
+    {
+        return ready.front();
+    }
+
+    int pick(const vector<Process> &, long long) override
+    {
+        int process = ready.front();
+        ready.pop_front();
+        return process;
+    }
+
+    bool empty() const override
+    {
+        return ready.empty();
+    }
+
+protected:
+    deque<int> ready;
+};
+
+// Define a policy for round-robin scheduling: FIFO order, but a process runs
+// for at most one quantum before going to the back of the queue
+class RoundRobinPolicy : public FcfsPolicy
+{
+public:
+    explicit RoundRobinPolicy(int quantum) : quantum(quantum) {}
+
+    long long time_slice(const Process &) const override
+    {
+        return quantum;
+    }
+
+private:
+    int quantum;
+};
+
+// Define a binary min-heap of processes keyed by a number, with ties going
+// to the lower order: the process pushed first, unless the caller gives
+// one. It records where each process sits, so a process's key can be
+// changed or the process removed in O(log n).
+class IndexedHeap
+{
+public:
+    bool empty() const
+    {
+        return heap.empty();
+    }
+
+    int top() const
+    {
+        return heap[0].process;
+    }
+
+    bool contains(int process) const
+    {
+        return process < (int)position.size() && position[process] >= 0;
+    }
+
+    void push(int process, long long key, long long order = -1)
+    {
+        if (process >= (int)position.size())
+        {
+            position.resize(process + 1, -1);
+        }
+        heap.push_back({key, order >= 0 ? order : pushes, process});
+        pushes++;
+        position[process] = heap.size() - 1;
+        sift_up(heap.size() - 1);
+    }
+
+    int pop()
+    {
+        int process = top();
+        erase(process);
+        return process;
+    }
+
+    // Set a new key for a process in the heap and restore the heap order
+    void update(int process, long long key)
+    {
+        int i = position[process];
+        bool smaller = key < heap[i].key;
+        heap[i].key = key;
+        if (smaller)
+        {
+            sift_up(i);
+        }
+        else
+        {
+            sift_down(i);
+        }
+    }
+
+    void erase(int process)
+    {
+        int i = position[process];
+        position[process] = -1;
+        if (i != (int)heap.size() - 1)
+        {
+            heap[i] = heap.back();
+            position[heap[i].process] = i;
+            heap.pop_back();
+            sift_down(i);
+            sift_up(i);
+        }
+        else
+        {
+            heap.pop_back();
+        }
+    }
+
+private:
+    struct Node
+    {
+        long long key;
+        long long order; // breaks ties
+        int process;
+    };
+
+    static bool before(const Node &a, const Node &b)
+    {
+        return a.key < b.key || (a.key == b.key && a.order < b.order);
+    }
+
+    void place(int i, const Node &node)
+    {
+        heap[i] = node;
+        position[node.process] = i;
+    }
+
+    void sift_up(int i)
+    {
+        Node node = heap[i];
+        while (i > 0 && before(node, heap[(i - 1) / 2]))
+        {
+            place(i, heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        place(i, node);
+    }
+
+    void sift_down(int i)
+    {
+        Node node = heap[i];
+        int n = heap.size();
+        while (true)
+        {
+            int child = 2 * i + 1;
+            if (child >= n)
+            {
+                break;
+            }
+            if (child + 1 < n && before(heap[child + 1], heap[child]))
+            {
+                child++;
+            }
+            if (!before(heap[child], node))
+            {
+                break;
+            }
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, node);
+    }
+
+    vector<Node> heap;
+    vector<int> position; // index in heap of each process, -1 when absent
+    long long pushes = 0;
+};
+
+// Define a policy for shortest-process-next scheduling: non-preemptive, the
+// shortest burst runs first
+class SpnPolicy : public Policy
+{
+public:
+    void add(int process, const vector<Process> &workload, long long) override
+    {
+        ready.push(process, workload[process].burst_time);
+    }
+
+    int peek(const vector<Process> &, long long) override
+    {
+        return ready.top();
+    }
+
+    int pick(const vector<Process> &, long long) override
+    {
+        return ready.pop();
+    }
+
+    bool empty() const override
+    {
+        return ready.empty();
+    }
+
+private:
+    IndexedHeap ready;
+};
+
+// Define a policy for shortest-remaining-time scheduling: preemptive SPN on
+// the time each process still needs. Ties go to the earlier arrival, so a
+// preempted process does not lose its place to a later one.
+class SrtPolicy : public Policy
+{
+public:
+    void add(int process, const vector<Process> &workload, long long) override
+    {
+        ready.push(process, workload[process].remaining_time, workload[process].id);
+    }
+
+    int peek(const vector<Process> &, long long) override
+    {
+        return ready.top();
+    }
+
+    int pick(const vector<Process> &, long long) override
+    {
+        return ready.pop();
+    }
+
+    bool empty() const override
+    {
+        return ready.empty();
+    }
+
+    bool preempts(int running, const vector<Process> &workload) override
+    {
+        return !ready.empty() && workload[ready.top()].remaining_time < workload[running].remaining_time;
+    }
+
+private:
+    IndexedHeap ready;
+};
+
+// Define a policy for highest-response-ratio-next scheduling: non-preemptive,
+// the highest (waiting time + burst time) / burst time runs first. A
+// process's ratio is 1 + (now - arrival) / burst, a line in now, so the ready
+// processes are kept in a kinetic tournament: a tree over process slots whose
+// nodes hold the winner of their subtree and the time at which that winner
+// is next overtaken. Adding or removing a process replays one path, and
+// moving the clock forward replays only the nodes whose winner changes, so
+// a pick costs O(log n) amortized however many distinct bursts there are.
+class HrrnPolicy : public Policy
+{
+public:
+    void add(int process, const vector<Process> &workload, long long now) override
+    {
+        advance(workload, now);
+        if (process >= capacity)
+        {
+            grow(workload, process);
+        }
+        winner[capacity + process] = process;
+        count++;
+        replay_path(workload, capacity + process);
+    }
+
+    int peek(const vector<Process> &workload, long long now) override
+    {
+        advance(workload, now);
+        return winner[1];
+    }
+
+    int pick(const vector<Process> &workload, long long now) override
+    {
+        advance(workload, now);
+        int process = winner[1];
+        winner[capacity + process] = -1;
+        count--;
+        replay_path(workload, capacity + process);
+        return process;
+    }
+
+    bool empty() const override
+    {
+        return count == 0;
+    }
+
+private:
+    static constexpr long long never = LLONG_MAX;
+
+    // Whether process a has a higher ratio than b at time t; on a tie the
+    // process that arrived first wins. Compares (t - arrival + burst) / burst
+    // without division, in 128 bits so long traces cannot overflow.
+    static bool beats(const Process &a, const Process &b, long long t)
+    {
+        __int128 ratio_a = (__int128)(t - a.arrival_time + a.burst_time) * b.burst_time;
+        __int128 ratio_b = (__int128)(t - b.arrival_time + b.burst_time) * a.burst_time;
+        return ratio_a > ratio_b || (ratio_a == ratio_b && a.id < b.id);
+    }
+
+    // The first time after which loser beats winner. Their difference in
+    // ratio, scaled by both bursts, is (loser burst - winner burst) * t +
+    // loser arrival * winner burst - winner arrival * loser burst, so the
+    // winner keeps winning for ever unless its burst is the longer one.
+    static long long overtaken(const Process &w, const Process &l)
+    {
+        __int128 slope = (__int128)w.burst_time - l.burst_time;
+        if (slope <= 0)
+        {
+            return never;
+        }
+        __int128 c = (__int128)l.arrival_time * w.burst_time - (__int128)w.arrival_time * l.burst_time;
+        // The loser wins once slope * t > c, or at slope * t == c if it
+        // would win the tie
+        __int128 floor_div = c / slope - (c % slope != 0 && c < 0);
+        __int128 t = l.id < w.id && c % slope == 0 ? floor_div : floor_div + 1;
+        return t >= (__int128)never ? never : (long long)t;
+    }
+
+    // Recompute a node from its children at the current time
+    void replay(const vector<Process> &workload, int node)
+    {
+        int left = winner[2 * node], right = winner[2 * node + 1];
+        long long next = min(fails[2 * node], fails[2 * node + 1]);
+        if (left < 0 || right < 0)
+        {
+            winner[node] = left < 0 ? right : left;
+        }
+        else
+        {
+            bool left_wins = beats(workload[left], workload[right], now);
+            int w = left_wins ? left : right, l = left_wins ? right : left;
+            winner[node] = w;
+            next = min(next, overtaken(workload[w], workload[l]));
+        }
+        fails[node] = next;
+    }
+
+    void replay_path(const vector<Process> &workload, int leaf)
+    {
+        for (int node = leaf / 2; node >= 1; node /= 2)
+        {
+            replay(workload, node);
+        }
+    }
+
+    // Move the clock to t, replaying every node whose winner has changed, or
+    // the whole tree should the clock have gone backwards
+    void advance(const vector<Process> &workload, long long t)
+    {
+        bool backwards = t < now;
+        now = t;
+        if (backwards)
+        {
+            for (int node = capacity - 1; node >= 1; node--)
+            {
+                replay(workload, node);
+            }
+        }
+        else if (capacity > 0 && fails[1] <= t)
+        {
+            refresh(workload, 1);
+        }
+    }
+
+    void refresh(const vector<Process> &workload, int node)
+    {
+        if (node >= capacity || fails[node] > now)
+        {
+            return;
+        }
+        refresh(workload, 2 * node);
+        refresh(workload, 2 * node + 1);
+        replay(workload, node);
+    }
+
+    // Double the leaves until process has one, then rebuild the tree
+    void grow(const vector<Process> &workload, int process)
+    {
+        int old_capacity = capacity;
+        vector<int> old_winner = winner;
+        while (capacity <= process)
+        {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+        }
+        winner.assign(2 * capacity, -1);
+        fails.assign(2 * capacity, never);
+        for (int slot = 0; slot < old_capacity; slot++)
+        {
+            winner[capacity + slot] = old_winner[old_capacity + slot];
+        }
+        for (int node = capacity - 1; node >= 1; node--)
+        {
+            replay(workload, node);
+        }
+    }
+
+    int capacity = 0;    // leaves, one per process slot
+    vector<int> winner;  // per node: the process with the highest ratio, or -1
+    vector<long long> fails; // per node: earliest time a winner in its subtree changes
+    long long now = LLONG_MIN;
+    int count = 0;
+};
+
+// Define a policy for multilevel feedback scheduling. New processes enter the
+// top queue; a process that uses up its slice drops one level, down to the
+// last. Queue i gets a quantum of base_quantum * 2^i and is served only while
+// every queue above it is empty. A process's level travels with it, so it
+// keeps its level when it moves to another core.
+class FeedbackPolicy : public Policy
+{
+public:
+    FeedbackPolicy(int levels, int base_quantum) : queues(levels), base_quantum(base_quantum) {}
+
+    void add(int process, const vector<Process> &workload, long long) override
+    {
+        queues[workload[process].level].push_back(process);
+        count++;
+    }
+
+    int peek(const vector<Process> &, long long) override
+    {
+        return first()->front();
+    }
+
+    int pick(const vector<Process> &, long long) override
+    {
+        deque<int> *queue = first();
+        int process = queue->front();
+        queue->pop_front();
+        count--;
+        return process;
+    }
+
+    bool empty() const override
+    {
+        return count == 0;
+    }
+
+    long long time_slice(const Process &p) const override
+    {
+        return (long long)base_quantum << p.level;
+    }
+
+    void expired(Process &p) override
+    {
+        if (p.level + 1 < (int)queues.size())
+        {
+            p.level++;
+        }
+    }
+
+private:
+    // Find the highest non-empty queue
+    deque<int> *first()
+    {
+        for (deque<int> &queue : queues)
+        {
+            if (!queue.empty())
+            {
+                return &queue;
+            }
+        }
+        return nullptr;
+    }
+
+    vector<deque<int>> queues;
+    int base_quantum;
+    int count = 0;
+};
+
+// Define an interface for a source of processes, read in order of arrival
+class Workload
+{
+public:
+    virtual ~Workload() {}
+
+    // Read the next process into p; false at the end or on an error
+    virtual bool next(Process &p) = 0;
+
+    string error; // set when reading stopped early
+};
+
+// Define a workload over an array of processes, sorted by arrival time
+class ArrayWorkload : public Workload
+{
+public:
+    ArrayWorkload(const Process *input, int n) : workload(input, input + n)
+    {
+        // Sort the processes in increasing order of their arrival time
+        stable_sort(workload.begin(), workload.end(), [](const Process &p1, const Process &p2)
+                    { return p1.arrival_time < p2.arrival_time; });
+    }
+
+    bool next(Process &p) override
+    {
+        if (position == workload.size())
+        {
+            return false;
+        }
+        p = workload[position];
+        p.id = position++;
+        return true;
+    }
+
+private:
+    vector<Process> workload;
+    size_t position = 0;
+};
+
+// Define a base for workloads read from a trace file in fixed-size chunks,
+// so memory does not grow with the length of the trace. Records must come in
+// order of arrival time.
+class TraceWorkload : public Workload
+{
+public:
+    explicit TraceWorkload(const string &path) : path(path), buffer(chunk_size)
+    {
+        file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            error = path + ": " + strerror(errno);
+        }
+    }
+
+    ~TraceWorkload() override
+    {
+        if (file)
+        {
+            fclose(file);
+        }
+    }
+
+    bool next(Process &p) override
+    {
+        if (!file || !error.empty() || !read_record(p))
+        {
+            return false;
+        }
+        const char *problem = nullptr;
+        if (p.burst_time <= 0)
+        {
+            problem = " has no burst time";
+        }
+        else if (p.arrival_time < last_arrival)
+        {
+            problem = " arrives out of order";
+        }
+        else if (max(p.arrival_time, last_end) > LLONG_MAX - p.burst_time)
+        {
+            // The clock could overflow before it finishes
+            problem = " ends too late";
+        }
+        if (problem)
+        {
+            error = path + ": record " + to_string(count + 1) + problem;
+            return false;
+        }
+        last_arrival = p.arrival_time;
+        last_end = max(p.arrival_time, last_end) + p.burst_time;
+        p.id = count++;
+        return true;
+    }
+
+protected:
+    // Read the next record's arrival, burst and priority
+    virtual bool read_record(Process &p) = 0;
+
+    // Make at least want unread bytes available in the buffer; false if the
+    // file ends first
+    bool fill(size_t want)
+    {
+        if (end - position >= want)
+        {
+            return true;
+        }
+        memmove(buffer.data(), buffer.data() + position, end - position);
+        end -= position;
+        position = 0;
+        if (want > buffer.size())
+        {
+            buffer.resize(want);
+        }
+        while (end < want && !feof(file))
+        {
+            end += fread(buffer.data() + end, 1, buffer.size() - end, file);
+            if (ferror(file))
+            {
+                error = path + ": read error";
+                return false;
+            }
+        }
+        return end >= want;
+    }
+
+    static const size_t chunk_size = 1 << 20;
+
+    string path;
+    FILE *file;
+    vector<char> buffer;
+    size_t position = 0; // next unread byte in buffer
+    size_t end = 0;      // end of the bytes read into buffer
+    long long count = 0; // records read so far
+    long long last_arrival = LLONG_MIN;
+    long long last_end = LLONG_MIN; // when the records so far would end, run one at a time
+};
+
+// Define a workload read from a CSV trace of "arrival,burst[,priority]"
+// lines. Blank lines, lines starting with '#' and a header line are skipped.
+class CsvWorkload : public TraceWorkload
+{
+public:
+    using TraceWorkload::TraceWorkload;
+
+protected:
+    bool read_record(Process &p) override
+    {
+        const char *line;
+        size_t length;
+        while (next_line(line, length))
+        {
+            line_number++;
+            if (length == 0 || line[0] == '#' || (line_number == 1 && !isdigit((unsigned char)line[0])))
+            {
+                continue;
+            }
+
+            long long fields[3] = {0, 0, 0};
+            int parsed = 0;
+            const char *cursor = line, *line_end = line + length;
+            while (parsed < 3)
+            {
+                auto result = from_chars(cursor, line_end, fields[parsed]);
+                if (result.ec != errc())
+                {
+                    break;
+                }
+                parsed++;
+                cursor = result.ptr;
+                if (cursor == line_end || *cursor != ',')
+                {
+                    break;
+                }
+                cursor++;
+            }
+            if (parsed < 2 || cursor != line_end || fields[2] < INT_MIN || fields[2] > INT_MAX)
+            {
+                error = path + ":" + to_string(line_number) + ": expected arrival,burst[,priority]";
+                return false;
+            }
+            p = Process();
+            p.arrival_time = fields[0];
+            p.burst_time = fields[1];
+            p.priority = (int)fields[2];
+            return true;
+        }
+        return false;
+    }
+
+private:
+    // Find the next line in the buffer, without its line ending
+    bool next_line(const char *&line, size_t &length)
+    {
+        size_t scanned = 0; // bytes known to hold no newline
+        while (true)
+        {
+            if (!fill(scanned + 1))
+            {
+                if (end == position)
+                {
+                    return false;
+                }
+                // The last line has no line ending
+                length = end - position;
+                break;
+            }
+            const char *start = buffer.data() + position;
+            const char *newline = (const char *)memchr(start + scanned, '\n', end - position - scanned);
+            if (newline)
+            {
+                length = newline - start;
+                break;
+            }
+            scanned = end - position;
+        }
+        line = buffer.data() + position;
+        position = min(end, position + length + 1);
+        if (length > 0 && line[length - 1] == '\r')
+        {
+            length--;
+        }
+        return true;
+    }
+
+    long long line_number = 0;
+};
+
+// Define a workload read from a binary trace: a sequence of records of three
+// little-endian 32-bit integers, arrival time, burst time and priority
+class BinaryWorkload : public TraceWorkload
+{
+public:
+    using TraceWorkload::TraceWorkload;
+
+protected:
+    bool read_record(Process &p) override
+    {
+        if (!fill(record_size))
+        {
+            if (end != position && error.empty())
+            {
+                error = path + ": truncated record at the end";
+            }
+            return false;
+        }
+        const unsigned char *bytes = (const unsigned char *)buffer.data() + position;
+        int32_t fields[3];
+        for (int i = 0; i < 3; i++)
+        {
+            uint32_t value = bytes[4 * i] | (bytes[4 * i + 1] << 8) | (bytes[4 * i + 2] << 16) | ((uint32_t)bytes[4 * i + 3] << 24);
+            fields[i] = (int32_t)value;
+        }
+        position += record_size;
+        p = Process();
+        p.arrival_time = fields[0];
+        p.burst_time = fields[1];
+        p.priority = fields[2];
+        return true;
+    }
+
+private:
+    static const size_t record_size = 12;
+};
+
+// Define a function to open a trace file; files ending in ".bin" are read as
+// binary records, anything else as CSV
+unique_ptr<Workload> open_trace(const string &path)
+{
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0)
+    {
+        return make_unique<BinaryWorkload>(path);
+    }
+    return make_unique<CsvWorkload>(path);
+}
+
+// Define a workload that replays records loaded once and shared, read-only,
+// by every run: each run has its own position but nothing it can change
+class SharedWorkload : public Workload
+{
+public:
+    explicit SharedWorkload(shared_ptr<const vector<Process>> records) : records(move(records)) {}
+
+    bool next(Process &p) override
+    {
+        if (position == records->size())
+        {
+            return false;
+        }
+        p = (*records)[position++];
+        return true;
+    }
+
+private:
+    shared_ptr<const vector<Process>> records;
+    size_t position = 0;
+};
+
+// Define a function to read a whole workload into memory so it can be
+// replayed; on an error the result is null and the error is left in source
+shared_ptr<const vector<Process>> load_workload(Workload &source)
+{
+    auto records = make_shared<vector<Process>>();
+    Process p;
+    while (source.next(p))
+    {
+        records->push_back(p);
+    }
+    if (!source.error.empty())
+    {
+        return nullptr;
+    }
+    return records;
+}
+
+// Define the ways processes can be spread over several cores
+enum class Dispatch
+{
+    global,  // one ready queue shared by every core
+    steal,   // a queue per core; an idle core steals from the longest queue
+    balance, // a queue per core; queues are evened out every balance_interval
+};
+
+// Define a structure for the simulated machine
+struct Machine
+{
+    int cores = 1;
+    Dispatch dispatch = Dispatch::global;
+    int balance_interval = 100; // time between balancing passes
+    int migration_cost = 0;     // time added to a process resuming on another core
+    bool affinity = false;      // per-core queues: a process that has run is never moved
+};
+
+// Define a structure for what one simulated core did
+struct CoreStats
+{
+    long long busy_time = 0;
+    long long dispatches = 0;
+    long long migrations = 0; // processes that resumed here after running elsewhere
+};
+
+// Define a structure for what the whole machine did
+struct MachineStats
+{
+    vector<CoreStats> cores;
+    long long first_arrival = 0;
+    long long last_finish = 0;
+};
+
+// Define a function to simulate a workload on a machine, passing each process
+// to finish as it completes. new_queue creates a ready queue: one for the
+// whole machine, or one per core.
+//
+// The clock jumps from one event to the next - an arrival, a completion, the
+// end of a time slice or a balancing pass - so the cost depends on the number
+// of events, not on the time they span. Busy cores are kept in a heap by the
+// time their slice ends, and per-core queues in heaps by length, so each
+// event costs O(log cores). Processes are read from the workload only when
+// they arrive and dropped when they finish, so memory depends on how many
+// are in the system at once, not on the length of the workload.
+MachineStats simulate(Workload &source, const function<unique_ptr<Policy>()> &new_queue, const Machine &machine,
+                      const function<void(const Process &)> &finish)
+{
+    const bool shared = machine.dispatch == Dispatch::global;
+    int cores = machine.cores;
+    vector<unique_ptr<Policy>> queues(shared ? 1 : cores);
+    for (auto &queue : queues)
+    {
+        queue = new_queue();
+    }
+
+    vector<Process> workload; // live processes, by slot
+    vector<int> free_slots;
+    Process upcoming;         // the next process to arrive
+    bool more = source.next(upcoming);
+    long long now = 0;
+
+    MachineStats stats;
+    stats.cores.resize(cores);
+    stats.first_arrival = more ? upcoming.arrival_time : 0;
+
+    vector<int> running(cores, -1);   // process on each core, or -1 when idle
+    vector<long long> dispatched_at(cores); // when the running process was last charged
+    vector<long long> slice_end(cores);     // when the running process leaves the core
+    vector<int> waiting(queues.size()); // processes in each ready queue
+    long long total_waiting = 0;
+    set<int> idle;                    // cores with nothing to run
+    IndexedHeap events;               // busy cores by slice end
+    IndexedHeap latest;               // busy cores, latest slice end first
+    IndexedHeap lightest;             // per-core queues by waiting + running
+    IndexedHeap longest;              // per-core queues, most waiting first
+    vector<int> touched;              // queues that gained processes at this instant
+    for (int c = 0; c < cores; c++)
+    {
+        idle.insert(c);
+        if (!shared)
+        {
+            lightest.push(c, 0);
+            longest.push(c, 0);
+        }
+    }
+    long long next_balance = machine.balance_interval;
+
+    auto update_load = [&](int q)
+    {
+        if (!shared)
+        {
+            lightest.update(q, waiting[q] + (running[q] >= 0));
+            longest.update(q, -waiting[q]);
+        }
+    };
+
+    auto enqueue = [&](int q, int slot)
+    {
+        queues[q]->add(slot, workload, now);
+        waiting[q]++;
+        total_waiting++;
+        update_load(q);
+        touched.push_back(q);
+    };
+
+    auto dequeue = [&](int q)
+    {
+        int slot = queues[q]->pick(workload, now);
+        waiting[q]--;
+        total_waiting--;
+        update_load(q);
+        return slot;
+    };
+
+    // Whether the process at the head of a queue may move to another core
+    auto movable = [&](int q)
+    {
+        return !machine.affinity || workload[queues[q]->peek(workload, now)].start_time < 0;
+    };
+
+    // Charge the running process for the time it has run
+    auto charge = [&](int c)
+    {
+        workload[running[c]].remaining_time -= now - dispatched_at[c];
+        stats.cores[c].busy_time += now - dispatched_at[c];
+        dispatched_at[c] = now;
+    };
+
+    auto dispatch = [&](int c, int slot)
+    {
+        Process &p = workload[slot];
+        if (p.last_core >= 0 && p.last_core != c)
+        {
+            p.remaining_time += machine.migration_cost;
+            stats.cores[c].migrations++;
+        }
+        p.last_core = c;
+        if (p.start_time < 0)
+        {
+            p.start_time = now;
+        }
+        running[c] = slot;
+        dispatched_at[c] = now;
+        slice_end[c] = now + min(p.remaining_time, queues[shared ? 0 : c]->time_slice(p));
+        stats.cores[c].dispatches++;
+        idle.erase(c);
+        events.push(c, slice_end[c]);
+        latest.push(c, -slice_end[c]);
+        update_load(c);
+    };
+
+    // Take the process off a core; returns it
+    auto stop = [&](int c)
+    {
+        charge(c);
+        int slot = running[c];
+        running[c] = -1;
+        idle.insert(c);
+        events.erase(c);
+        latest.erase(c);
+        update_load(c);
+        return slot;
+    };
+
+    // Add every process that has arrived by now to a ready queue: the shared
+    // one, or the least loaded core's
+    auto admit = [&]()
+    {
+        while (more && upcoming.arrival_time <= now)
+        {
+            int slot;
+            if (free_slots.empty())
+            {
+                slot = workload.size();
+                workload.push_back(upcoming);
+            }
+            else
+            {
+                slot = free_slots.back();
+                free_slots.pop_back();
+                workload[slot] = upcoming;
+            }
+            Process &p = workload[slot];
+            p.remaining_time = p.burst_time;
+            p.start_time = -1;
+            p.last_core = -1;
+            p.level = 0;
+            enqueue(shared ? 0 : lightest.top(), slot);
+            more = source.next(upcoming);
+        }
+    };
+
+    // Move processes from the longest queues to the lightest until no two
+    // differ by more than one
+    auto balance = [&]()
+    {
+        while (true)
+        {
+            int from = longest.top(), to = lightest.top();
+            int from_load = waiting[from] + (running[from] >= 0), to_load = waiting[to] + (running[to] >= 0);
+            if (waiting[from] == 0 || from_load - to_load <= 1 || !movable(from))
+            {
+                break;
+            }
+            enqueue(to, dequeue(from));
+        }
+    };
+
+    // Give work to idle cores: from the shared queue, from their own queue,
+    // or by stealing from the longest
+    auto fill = [&]()
+    {
+        if (shared)
+        {
+            while (!idle.empty() && waiting[0] > 0)
+            {
+                dispatch(*idle.begin(), dequeue(0));
+            }
+            return;
+        }
+        for (int q : touched)
+        {
+            if (running[q] < 0 && waiting[q] > 0)
+            {
+                dispatch(q, dequeue(q));
+            }
+        }
+        if (machine.dispatch == Dispatch::steal)
+        {
+            while (!idle.empty() && total_waiting > 0 && movable(longest.top()))
+            {
+                int c = *idle.begin();
+                dispatch(c, dequeue(longest.top()));
+            }
+        }
+    };
+
+    // Let newly queued processes preempt running ones where the policy says
+    // so: with a shared queue the victim is the core that would stay busy
+    // longest, with per-core queues it is the core the process was queued on
+    auto preempt = [&]()
+    {
+        if (shared)
+        {
+            while (waiting[0] > 0 && !latest.empty())
+            {
+                int c = latest.top();
+                charge(c);
+                if (!queues[0]->preempts(running[c], workload))
+                {
+                    break;
+                }
+                enqueue(0, stop(c));
+                dispatch(c, dequeue(0));
+            }
+            return;
+        }
+        for (size_t i = 0, n = touched.size(); i < n; i++)
+        {
+            int q = touched[i];
+            if (running[q] >= 0 && waiting[q] > 0)
+            {
+                charge(q);
+                if (queues[q]->preempts(running[q], workload))
+                {
+                    enqueue(q, stop(q));
+                    dispatch(q, dequeue(q));
+                }
+            }
+        }
+    };
+
+    while (!events.empty() || total_waiting > 0 || more)
+    {
+        // Jump to the next event
+        long long next = LLONG_MAX;
+        if (!events.empty())
+        {
+            next = slice_end[events.top()];
+        }
+        if (more)
+        {
+            next = min(next, upcoming.arrival_time);
+        }
+        if (machine.dispatch == Dispatch::balance && total_waiting > 0)
+        {
+            if (next_balance <= now)
+            {
+                next_balance = (now / machine.balance_interval + 1) * machine.balance_interval;
+            }
+            next = min(next, next_balance);
+        }
+        now = max(now, next);
+        touched.clear();
+
+        // Running processes that finish or use up their slice now. Processes
+        // arriving at this instant queue ahead of the ones that expired.
+        vector<pair<int, int>> expired;
+        while (!events.empty() && slice_end[events.top()] == now)
+        {
+            int c = events.top();
+            int slot = stop(c);
+            touched.push_back(c); // its own queue may have more to run
+            Process &p = workload[slot];
+            if (p.remaining_time == 0)
+            {
+                p.finish_time = now;
+                stats.last_finish = now;
+                finish(p);
+                free_slots.push_back(slot);
+            }
+            else
+            {
+                queues[shared ? 0 : c]->expired(p);
+                expired.emplace_back(c, slot);
+            }
+        }
+        admit();
+        for (auto [c, slot] : expired)
+        {
+            enqueue(shared ? 0 : c, slot);
+        }
+        if (machine.dispatch == Dispatch::balance && now == next_balance)
+        {
+            balance();
+            next_balance += machine.balance_interval;
+        }
+        fill();
+        preempt();
+    }
+    return stats;
+}
+
+// Define a histogram of non-negative integers in logarithmic buckets, in the
+// manner of HDR histograms: values below 256 are counted exactly and larger
+// ones in 128 buckets per power of two, so a percentile read back is within
+// 1% of the value recorded. Buckets are added only as large values arrive.
+class Histogram
+{
+public:
+    void record(long long value)
+    {
+        uint64_t v = max(value, 0LL);
+        size_t index = bucket(v);
+        if (index >= counts.size())
+        {
+            counts.resize(index + 1);
+        }
+        counts[index]++;
+        total++;
+        sum += v;
+        maximum = max(maximum, v);
+    }
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    double mean() const
+    {
+        return total ? (double)sum / total : 0;
+    }
+
+    uint64_t max_value() const
+    {
+        return maximum;
+    }
+
+    // Return the value at or below which the given fraction of the recorded
+    // values fall: the highest value of its bucket, but never above the max
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(fraction * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return min(highest(i), maximum);
+            }
+        }
+        return maximum;
+    }
+
+private:
+    static const int sub_bits = 7; // 2^sub_bits buckets per power of two
+
+    static size_t bucket(uint64_t v)
+    {
+        if (v < (2u << sub_bits))
+        {
+            return v;
+        }
+        int shift = 63 - __builtin_clzll(v) - sub_bits;
+        return ((size_t)shift << sub_bits) + (v >> shift);
+    }
+
+    static uint64_t highest(size_t index)
     {
-        if (readyProcess[i].burst_time < min_service_time)
+        if (index < (2u << sub_bits))
         {
-            min_service_time = readyProcess[i].burst_time;
-            min_service_time_process_index = i;
+            return index;
         }
+        int shift = (index >> sub_bits) - 1;
+        uint64_t mantissa = index - ((size_t)shift << sub_bits);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t maximum = 0;
+};
+
+// Define a structure for the latency metrics of a run, gathered as each
+// process finishes so no per-process results need to be kept
+struct Metrics
+{
+    Histogram turn_around_time;
+    Histogram waiting_time;  // turn-around time less the burst time
+    Histogram response_time; // from arrival to first run
+    Histogram normalized_turn_around_time; // in thousandths
+    double normalized_sum = 0; // for an exact mean
+
+    // Scale of the normalized turn-around histogram
+    static constexpr double normalized_scale = 1000;
+
+    void record(const Process &p)
+    {
+        long long turn_around = p.finish_time - p.arrival_time;
+        double normalized = (double)turn_around / p.burst_time;
+        turn_around_time.record(turn_around);
+        waiting_time.record(turn_around - p.burst_time);
+        response_time.record(p.start_time - p.arrival_time);
+        normalized_turn_around_time.record(llround(normalized * normalized_scale));
+        normalized_sum += normalized;
     }
-    return min_service_time_process_index;
+
+    double normalized_mean() const
+    {
+        return turn_around_time.count() ? normalized_sum / turn_around_time.count() : 0;
+    }
+};
+
+// Define a function to print the mean, percentiles and maximum of every
+// metric of a run
+void print_metrics(const Metrics &metrics)
+{
+    auto line = [](const char *name, const Histogram &h, double mean, double scale)
+    {
+        cout << name << ": mean " << mean << ", p50 " << h.percentile(0.50) / scale << ", p95 " << h.percentile(0.95) / scale;
+        cout << ", p99 " << h.percentile(0.99) / scale << ", max " << h.max_value() / scale << endl;
+    };
+    cout << "processes: " << metrics.turn_around_time.count() << endl;
+    line("turn-around time", metrics.turn_around_time, metrics.turn_around_time.mean(), 1);
+    line("waiting time", metrics.waiting_time, metrics.waiting_time.mean(), 1);
+    line("response time", metrics.response_time, metrics.response_time.mean(), 1);
+    line("normalized turn-around time", metrics.normalized_turn_around_time, metrics.normalized_mean(), Metrics::normalized_scale);
 }
 
-// Define a function to simulate the FIFO scheduling algorithm
-void fifo_scheduling()
+// Define the names of the policies; results refer to a policy by its index here
+const vector<string> policy_names = {"fifo", "spn", "srt", "rr", "hrrn", "feedback"};
+
+// Define the ways per-process results can be written
+enum class ResultFormat
 {
-    int n = sizeof(processes) / sizeof(processes[0]);
+    text,   // the lines printed on the console
+    csv,    // policy,id,arrival,burst,start,finish,core lines
+    binary, // 48-byte little-endian records, see write
+};
+
+// Define a writer of per-process results that formats them into a large
+// buffer and hands it to the file only when it fills, instead of flushing
+// a line at a time
+class ResultWriter
+{
+public:
+    ResultWriter(FILE *file, ResultFormat format) : file(file), format(format), buffer(buffer_size) {}
+
+    ~ResultWriter()
+    {
+        flush();
+    }
+
+    // Write the result of a process run under the policy with the given
+    // index in policy_names
+    void write(const Process &p, int policy)
+    {
+        reserve(record_limit);
+        char *out = buffer.data() + used;
+        if (format == ResultFormat::binary)
+        {
+            // int64 id, int32 policy, int64 arrival, burst, start and finish,
+            // int32 last core
+            put(out, p.id, 8);
+            put(out + 8, (uint32_t)policy, 4);
+            int64_t times[4] = {p.arrival_time, p.burst_time, p.start_time, p.finish_time};
+            for (int i = 0; i < 4; i++)
+            {
+                put(out + 12 + 8 * i, (uint64_t)times[i], 8);
+            }
+            put(out + 44, (uint32_t)p.last_core, 4);
+            used += binary_record_size;
+            return;
+        }
+        if (format == ResultFormat::csv)
+        {
+            append(policy_names[policy]);
+            for (long long field : {p.id, p.arrival_time, p.burst_time, p.start_time, p.finish_time, (long long)p.last_core})
+            {
+                append(",");
+                append(field);
+            }
+            append("\n");
+            return;
+        }
+        // The normalized turn-around time to two decimal places
+        long long hundredths = llround(100.0 * (p.finish_time - p.arrival_time) / p.burst_time);
+        append("arrival time: ");
+        append(p.arrival_time);
+        append(", burst time: ");
+        append(p.burst_time);
+        append(", start time: ");
+        append(p.start_time);
+        append(", finish time: ");
+        append(p.finish_time);
+        append(", normalized turn-around time: ");
+        append(hundredths / 100);
+        append(hundredths % 100 < 10 ? ".0" : ".");
+        append(hundredths % 100);
+        append("\n");
+    }
+
+    // Write out everything buffered
+    void flush()
+    {
+        if (used > 0 && fwrite(buffer.data(), 1, used, file) != used)
+        {
+            failed = true;
+        }
+        used = 0;
+        fflush(file);
+    }
 
-    // Sort the processes in increasing order of their arrival time
-    sort(processes, processes + n, [](const Process &p1, const Process &p2)
-         { return p1.arrival_time < p2.arrival_time; });
+    bool failed = false; // set when a write did not complete
 
-    // Initialize the start time and finish time for each process
-    int start_time[n];
-    int finish_time[n];
+    // The column names of CSV output
+    static constexpr const char *csv_header = "policy,id,arrival,burst,start,finish,core\n";
 
-    // Initialize the start time and finish time for the first process
-    start_time[0] = processes[0].arrival_time;
-    finish_time[0] = start_time[0] + processes[0].burst_time;
+private:
+    static const size_t buffer_size = 1 << 20;
+    static const size_t record_limit = 256; // more than the longest record
+    static const size_t binary_record_size = 48;
+
+    void reserve(size_t bytes)
+    {
+        if (buffer.size() - used < bytes)
+        {
+            flush();
+        }
+    }
 
-    // Process each process in order of their arrival time
-    for (int i = 1; i < n; i++)
+    // Add text or a number to the buffer; the caller has reserved room
+    void append(string_view text)
     {
-        // Calculate the start time and finish time for the current process
-        start_time[i] = max(finish_time[i - 1], processes[i].arrival_time);
-        finish_time[i] = start_time[i] + processes[i].burst_time;
+        memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
     }
 
-    // Print the start time, finish time, and turn-around time for each process
-    for (int i = 0; i < n; i++)
+    void append(long long value)
     {
-        int turn_around_time = finish_time[i] - processes[i].arrival_time;
-        int normalized_turn_around_time = turn_around_time / processes[i].burst_time;
-        cout << "arrival time: " << processes[i].arrival_time << ", ";
-        cout << "burst time: " << processes[i].burst_time << ", ";
-        cout << "start time: " << start_time[i] << ", ";
-        cout << "finish time: " << finish_time[i] << ", ";
-        cout << "normalized turn-around time: " << normalized_turn_around_time << endl;
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value).ptr - buffer.data();
     }
-}
 
-// Define a function to simulate the SPN scheduling algorithm
-// Define a function to simulate the SPN scheduling algorithm
-void spn_scheduling()
+    static void put(char *out, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            out[i] = (char)(value >> (8 * i));
+        }
+    }
+
+    FILE *file;
+    ResultFormat format;
+    vector<char> buffer;
+    size_t used = 0;
+};
+
+// Define an executor that runs real tasks on a pool of worker threads, in
+// the order a scheduling policy gives them. A task is a callable that does a
+// step of work and returns whether more remains; after each step a task can
+// be put back in the ready queue when its time slice is over or the policy
+// says a waiting task should preempt it, so round robin, SRT and feedback
+// work on tasks written as steps. Times are counted in ticks since the
+// executor started, and each finished task is passed to finish as a Process
+// with its measured arrival, start and finish and its measured running time
+// as the burst time. finish is called with the executor's lock held, one
+// task at a time. Tasks must not throw.
+class Executor
 {
-    int n = sizeof(processes) / sizeof(processes[0]);
+public:
+    using Task = function<bool()>;
+
+    Executor(int workers, unique_ptr<Policy> policy, chrono::microseconds tick, const function<void(const Process &)> &finish)
+        : queue(move(policy)), tick(tick), finish(finish), epoch(chrono::steady_clock::now())
+    {
+        for (int w = 0; w < workers; w++)
+        {
+            pool.emplace_back([this, w]()
+                              { work(w); });
+        }
+    }
+
+    ~Executor()
+    {
+        wait();
+        {
+            lock_guard<mutex> lock(state);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (thread &t : pool)
+        {
+            t.join();
+        }
+    }
+
+    // Submit a task that takes about estimated_cost ticks; returns its id
+    long long submit(Task task, long long estimated_cost)
+    {
+        lock_guard<mutex> lock(state);
+        int slot;
+        if (free_slots.empty())
+        {
+            slot = workload.size();
+            workload.emplace_back();
+            tasks.emplace_back();
+            run_time.emplace_back();
+        }
+        else
+        {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        long long arrival = now();
+        workload[slot] = {arrival, estimated_cost, -1, 0, estimated_cost, 0, submitted, -1, 0};
+        tasks[slot] = move(task);
+        run_time[slot] = {};
+        queue->add(slot, workload, arrival);
+        pending++;
+        ready.notify_one();
+        return submitted++;
+    }
 
-    // Sort the processes in increasing order of their arrival time
-    sort(processes, processes + n, [](const Process &p1, const Process &p2)
-         { return p1.arrival_time < p2.arrival_time; });
+    // Submit a task that runs to completion in one call
+    long long submit(function<void()> task, long long estimated_cost)
+    {
+        return submit(Task([task = move(task)]()
+                           { task(); return false; }),
+                      estimated_cost);
+    }
 
-    deque<Process> newProcess;
-    deque<Process> readyProcess;
-    deque<Process> exitProcess;
+    // Wait until every submitted task has finished
+    void wait()
+    {
+        unique_lock<mutex> lock(state);
+        done.wait(lock, [this]()
+                  { return pending == 0; });
+    }
 
-    // Add the processes to the new process queue
-    for (int i = 0; i < n; i++)
+    // Return the ticks since the executor started
+    long long now() const
     {
-        Process p;
-        p.arrival_time = processes[i].arrival_time;
-        p.burst_time = processes[i].burst_time;
-        newProcess.push_back(p);
+        return (chrono::steady_clock::now() - epoch) / tick;
     }
 
-    unsigned int current_time = 1; // current time of OS
-    Process runningProcess;        // is running process
-    while (!(newProcess.empty() && readyProcess.empty()))
+private:
+    void work(int worker)
     {
-        while (true) // add arrived processes to ready queue
+        unique_lock<mutex> lock(state);
+        while (true)
         {
-            if (!newProcess.empty() && newProcess.front().arrival_time <= current_time)
+            ready.wait(lock, [this]()
+                       { return stopping || !queue->empty(); });
+            if (queue->empty())
             {
-                runningProcess = newProcess.front(); // pointer to find ready process
-                newProcess.pop_front();
-                readyProcess.push_back(runningProcess);
+                return;
             }
-            else if (!readyProcess.empty() && readyProcess.front().arrival_time <= current_time)
+            long long started = now();
+            int slot = queue->pick(workload, started);
+            Process &p = workload[slot];
+            if (p.start_time < 0)
             {
-                break;
+                p.start_time = started;
             }
-            else
+            p.last_core = worker;
+            long long slice = queue->time_slice(p);
+            long long slice_end = slice > LLONG_MAX - started ? LLONG_MAX : started + slice;
+            Task task = move(tasks[slot]);
+
+            // Run steps until the task is done, its slice is over or it is
+            // preempted; the lock is held only between steps
+            bool more;
+            while (true)
+            {
+                lock.unlock();
+                auto step_start = chrono::steady_clock::now();
+                more = task();
+                auto step_time = chrono::steady_clock::now() - step_start;
+                lock.lock();
+                run_time[slot] += step_time;
+                long long elapsed = run_time[slot] / tick;
+                workload[slot].remaining_time = max(workload[slot].burst_time - elapsed, 1LL);
+                if (!more || now() >= slice_end || queue->preempts(slot, workload))
+                {
+                    break;
+                }
+            }
+
+            if (more)
             {
-                current_time++;
+                tasks[slot] = move(task);
+                queue->expired(workload[slot]);
+                queue->add(slot, workload, now());
+                continue;
             }
+            Process result = workload[slot];
+            result.finish_time = now();
+            result.remaining_time = 0;
+            result.burst_time = max<long long>(run_time[slot] / tick, 1);
+            finish(result);
+            free_slots.push_back(slot);
+            if (--pending == 0)
+            {
+                done.notify_all();
+            }
+        }
+    }
+
+    unique_ptr<Policy> queue;
+    chrono::microseconds tick;
+    function<void(const Process &)> finish;
+    chrono::steady_clock::time_point epoch;
+
+    mutex state; // guards everything below
+    condition_variable ready; // a task was queued, or the executor is stopping
+    condition_variable done;  // every task has finished
+    vector<Process> workload; // tasks submitted and not finished, by slot
+    vector<Task> tasks;       // their callables, while not running
+    vector<chrono::steady_clock::duration> run_time; // time each has run so far
+    vector<int> free_slots;
+    long long submitted = 0;
+    long long pending = 0;
+    bool stopping = false;
+    vector<thread> pool; // last, so the workers start after everything else
+};
+
+// Define a function to run a workload for real on an executor: each process
+// becomes a task submitted at its arrival time, counted from the first one,
+// that keeps a worker busy for its burst time, one tick per step
+void execute_workload(const vector<Process> &records, unique_ptr<Policy> policy, int workers, chrono::microseconds tick,
+                      const function<void(const Process &)> &finish)
+{
+    Executor executor(workers, move(policy), tick, finish);
+    long long first_arrival = records.empty() ? 0 : records[0].arrival_time;
+    for (const Process &p : records)
+    {
+        long long delay = p.arrival_time - first_arrival - executor.now();
+        if (delay > 0)
+        {
+            this_thread::sleep_for(delay * tick);
+        }
+        executor.submit(Executor::Task([left = p.burst_time, tick]() mutable
+                                       {
+                                           auto until = chrono::steady_clock::now() + tick;
+                                           while (chrono::steady_clock::now() < until)
+                                           {
+                                           }
+                                           return --left > 0; }),
+                        p.burst_time);
+    }
+    executor.wait();
+}
+
+// Define a function to create a policy by name, or return null for an unknown
+// name; quantum is the round-robin slice and the top feedback queue's slice
+unique_ptr<Policy> make_policy(const string &name, int quantum)
+{
+    if (name == "fifo")
+    {
+        return make_unique<FcfsPolicy>();
+    }
+    if (name == "spn")
+    {
+        return make_unique<SpnPolicy>();
+    }
+    if (name == "srt")
+    {
+        return make_unique<SrtPolicy>();
+    }
+    if (name == "rr")
+    {
+        return make_unique<RoundRobinPolicy>(quantum);
+    }
+    if (name == "hrrn")
+    {
+        return make_unique<HrrnPolicy>();
+    }
+    if (name == "feedback")
+    {
+        return make_unique<FeedbackPolicy>(3, quantum);
+    }
+    return nullptr;
+}
+
+// Define a function to print each core's utilization over the run, and how
+// many processes resumed on it after running on another core
+void print_machine(const MachineStats &stats)
+{
+    long long span = stats.last_finish - stats.first_arrival;
+    long long migrations = 0;
+    for (size_t c = 0; c < stats.cores.size(); c++)
+    {
+        const CoreStats &core = stats.cores[c];
+        cout << "core " << c << ": utilization " << (span > 0 ? 100.0 * core.busy_time / span : 0) << "%, ";
+        cout << "dispatches: " << core.dispatches << ", migrations: " << core.migrations << endl;
+        migrations += core.migrations;
+    }
+    cout << "total migrations: " << migrations << endl;
+}
+
+// Define a function to tell whether a policy uses the quantum
+bool uses_quantum(const string &name)
+{
+    return name == "rr" || name == "feedback";
+}
+
+// Define a structure for one simulation in a sweep and what came of it
+struct SweepRun
+{
+    int workload; // index into the sweep's workloads
+    string policy;
+    int quantum;  // 0 when the policy has none
+    int cores;
+
+    Metrics metrics;
+    MachineStats stats;
+};
+
+// Define a function to run every simulation of a sweep on a pool of threads.
+// Each thread takes the next run not yet started and stores its results in
+// that run's own entry, so the results do not depend on the number of
+// threads or the order in which the runs end.
+void run_sweep(vector<SweepRun> &runs, const vector<shared_ptr<const vector<Process>>> &workloads, const Machine &machine, int threads)
+{
+    atomic<size_t> next_run{0};
+    auto work = [&]()
+    {
+        for (size_t i = next_run++; i < runs.size(); i = next_run++)
+        {
+            SweepRun &run = runs[i];
+            Machine config = machine;
+            config.cores = run.cores;
+            SharedWorkload source(workloads[run.workload]);
+            run.stats = simulate(source, [&]()
+                                 { return make_policy(run.policy, max(run.quantum, 1)); }, config, [&](const Process &p)
+                                 { run.metrics.record(p); });
         }
+    };
+
+    vector<thread> pool;
+    for (int t = 1; t < threads; t++)
+    {
+        pool.emplace_back(work);
+    }
+    work();
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+}
 
-        // find min service time process and run
-        if (!readyProcess.empty())
+// Define a function to print one line per run of a sweep, in the order of
+// the grid, with the means over every process, the tail of the turn-around
+// time and the machine's utilization
+void print_sweep(const vector<SweepRun> &runs, const vector<string> &names)
+{
+    cout << left << setw(20) << "workload" << setw(10) << "policy" << right << setw(8) << "quantum" << setw(6) << "cores";
+    cout << setw(10) << "processes" << setw(12) << "turnaround" << setw(12) << "waiting" << setw(12) << "response";
+    cout << setw(12) << "normalized" << setw(12) << "p99 tat" << setw(12) << "max tat" << setw(12) << "util %";
+    cout << setw(12) << "migrations" << endl;
+    cout << fixed << setprecision(2);
+    for (const SweepRun &run : runs)
+    {
+        const Metrics &m = run.metrics;
+        long long busy = 0, migrations = 0;
+        for (const CoreStats &core : run.stats.cores)
         {
-            int min_service_time_process_index = find_min_time_process_index(readyProcess); // get min service time process index in ready process
-            runningProcess = readyProcess.at(min_service_time_process_index);               // get running process (min service time process)
-            current_time += runningProcess.burst_time;                                      // run
-            runningProcess.finish_time = current_time;                                      // finish
-            readyProcess.erase(readyProcess.begin() + min_service_time_process_index);      // delete running process from ready queue
-            exitProcess.push_back(runningProcess);                                          // add running process into exit queue
+            busy += core.busy_time;
+            migrations += core.migrations;
         }
+        long long span = (run.stats.last_finish - run.stats.first_arrival) * run.cores;
+        cout << left << setw(20) << names[run.workload] << setw(10) << run.policy << right;
+        cout << setw(8) << (run.quantum > 0 ? to_string(run.quantum) : "-") << setw(6) << run.cores;
+        cout << setw(10) << m.turn_around_time.count() << setw(12) << m.turn_around_time.mean();
+        cout << setw(12) << m.waiting_time.mean() << setw(12) << m.response_time.mean() << setw(12) << m.normalized_mean();
+        cout << setw(12) << m.turn_around_time.percentile(0.99) << setw(12) << m.turn_around_time.max_value();
+        cout << setw(12) << (span > 0 ? 100.0 * busy / span : 0.0);
+        cout << setw(12) << migrations << endl;
     }
+}
 
-    // print result
-    for (int i = 0; i < n; i++)
+// Define a function to split a comma-separated option value
+vector<string> split_list(const string &value)
+{
+    vector<string> items;
+    size_t start = 0;
+    while (true)
     {
-        int turn_around_time = exitProcess[i].finish_time - exitProcess[i].arrival_time;
-        int normalized_turn_around_time = turn_around_time / exitProcess[i].burst_time;
-        int start_time = exitProcess[i].finish_time - exitProcess[i].burst_time; // calculate start time
-        cout << "arrival time: " << exitProcess[i].arrival_time << ", ";
-        cout << "burst time: " << exitProcess[i].burst_time << ", ";
-        cout << "start time: " << start_time << ", "; // print start time
-        cout << "finish time: " << exitProcess[i].finish_time << ", ";
-        cout << "normalized turn-around time: " << normalized_turn_around_time << endl;
+        size_t comma = value.find(',', start);
+        items.push_back(value.substr(start, comma - start));
+        if (comma == string::npos)
+        {
+            return items;
+        }
+        start = comma + 1;
     }
 }
 
-int main()
+// Define a function to print how to run the program
+void usage(const char *program)
+{
+    cerr << "Usage: " << program << " [--policy fifo|spn|srt|rr|hrrn|feedback] [--quantum q] [--trace file]" << endl;
+    cerr << "       [--cores n] [--dispatch global|steal|balance] [--balance-interval t]" << endl;
+    cerr << "       [--migration-cost t] [--affinity on|off] [--sweep threads] [--results file|none]" << endl;
+    cerr << "       [--execute workers] [--tick microseconds]" << endl;
+    cerr << "Runs every policy unless one is given. A trace holds CSV lines of arrival,burst[,priority]," << endl;
+    cerr << "or 12-byte binary records of the same fields if its name ends in .bin, in order of" << endl;
+    cerr << "arrival; without one the built-in workload is used. The quantum defaults to 4." << endl;
+    cerr << "With several cores, global dispatch shares one ready queue; steal and balance give" << endl;
+    cerr << "each core its own, evened out by idle cores stealing or by a periodic pass." << endl;
+    cerr << "--sweep runs every combination of the comma-separated lists given to --policy," << endl;
+    cerr << "--quantum, --trace (\"builtin\" for the built-in workload) and --cores on that many" << endl;
+    cerr << "threads (0 for one per hardware thread) and prints one line per run." << endl;
+    cerr << "Each policy's results are printed per process and summarized; --results writes the" << endl;
+    cerr << "per-process results to a file instead, as CSV or as binary if its name ends in .bin." << endl;
+    cerr << "--execute runs the workload for real on that many worker threads, each time unit" << endl;
+    cerr << "a tick of busy work (200 microseconds unless given), and compares the observed" << endl;
+    cerr << "metrics with the ones simulated on as many cores." << endl;
+}
+
+int main(int argc, char *argv[])
 {
-    cout << "FIFO scheduling:" << endl;
-    fifo_scheduling();
-    cout << endl;
-    cout << "SPN scheduling:" << endl;
-    spn_scheduling();
+    vector<int> quanta = {4};
+    vector<string> traces = {"builtin"};
+    vector<string> names = policy_names;
+    vector<int> core_counts = {1};
+    string results;
+    Machine machine;
+    int threads = -1; // -1 without --sweep
+    int workers = 0;  // 0 without --execute
+    int tick = 200;   // microseconds per time unit with --execute
+    bool valid = argc % 2 == 1;
+
+    // Parse a list of positive numbers into numbers
+    auto parse_counts = [&](const string &value, vector<int> &numbers)
+    {
+        numbers.clear();
+        for (const string &item : split_list(value))
+        {
+            numbers.push_back(atoi(item.c_str()));
+            valid = valid && numbers.back() > 0;
+        }
+    };
+
+    for (int i = 1; valid && i + 1 < argc; i += 2)
+    {
+        string option = argv[i], value = argv[i + 1];
+        if (option == "--quantum")
+        {
+            parse_counts(value, quanta);
+        }
+        else if (option == "--trace")
+        {
+            traces = split_list(value);
+        }
+        else if (option == "--policy")
+        {
+            names = split_list(value);
+            for (const string &name : names)
+            {
+                valid = valid && make_policy(name, 1);
+            }
+        }
+        else if (option == "--cores")
+        {
+            parse_counts(value, core_counts);
+        }
+        else if (option == "--dispatch" && (value == "global" || value == "steal" || value == "balance"))
+        {
+            machine.dispatch = value == "global" ? Dispatch::global : value == "steal" ? Dispatch::steal : Dispatch::balance;
+        }
+        else if (option == "--balance-interval")
+        {
+            machine.balance_interval = atoi(value.c_str());
+        }
+        else if (option == "--migration-cost")
+        {
+            machine.migration_cost = atoi(value.c_str());
+            valid = machine.migration_cost >= 0;
+        }
+        else if (option == "--affinity" && (value == "on" || value == "off"))
+        {
+            machine.affinity = value == "on";
+        }
+        else if (option == "--results")
+        {
+            results = value;
+        }
+        else if (option == "--execute")
+        {
+            workers = atoi(value.c_str());
+            valid = workers > 0;
+        }
+        else if (option == "--tick")
+        {
+            tick = atoi(value.c_str());
+            valid = tick > 0;
+        }
+        else if (option == "--sweep")
+        {
+            threads = atoi(value.c_str());
+            valid = threads >= 0;
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    // Only a sweep takes more than one quantum, trace or core count
+    if (threads < 0 && (quanta.size() > 1 || traces.size() > 1 || core_counts.size() > 1))
+    {
+        valid = false;
+    }
+    // Executing runs on the executor's workers, not on simulated cores
+    if (workers > 0 && (threads >= 0 || core_counts[0] > 1))
+    {
+        valid = false;
+    }
+    if (!valid || machine.balance_interval <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (threads >= 0)
+    {
+        // Load each workload once; every run replays it without changing it
+        vector<shared_ptr<const vector<Process>>> workloads;
+        for (const string &trace : traces)
+        {
+            unique_ptr<Workload> source;
+            if (trace == "builtin")
+            {
+                source = make_unique<ArrayWorkload>(processes, sizeof(processes) / sizeof(processes[0]));
+            }
+            else
+            {
+                source = open_trace(trace);
+            }
+            workloads.push_back(load_workload(*source));
+            if (!workloads.back())
+            {
+                cerr << "Error: " << source->error << endl;
+                return 1;
+            }
+        }
+
+        // Lay out the grid; policies without a quantum run once per workload
+        // and core count
+        vector<SweepRun> runs;
+        for (size_t w = 0; w < traces.size(); w++)
+        {
+            for (const string &name : names)
+            {
+                for (size_t q = 0; q < (uses_quantum(name) ? quanta.size() : 1); q++)
+                {
+                    for (int cores : core_counts)
+                    {
+                        runs.push_back({(int)w, name, uses_quantum(name) ? quanta[q] : 0, cores, Metrics(), MachineStats()});
+                    }
+                }
+            }
+        }
+        if (threads == 0)
+        {
+            threads = max(1u, thread::hardware_concurrency());
+        }
+        run_sweep(runs, workloads, machine, min<int>(threads, runs.size()));
+        print_sweep(runs, traces);
+        return 0;
+    }
+
+    // Per-process results go to the console, a file, or nowhere
+    unique_ptr<FILE, int (*)(FILE *)> output(nullptr, fclose);
+    unique_ptr<ResultWriter> writer;
+    if (results.empty())
+    {
+        writer = make_unique<ResultWriter>(stdout, ResultFormat::text);
+    }
+    else if (results != "none")
+    {
+        output.reset(fopen(results.c_str(), "wb"));
+        if (!output)
+        {
+            cerr << "Error: " << results << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        bool binary = results.size() >= 4 && results.compare(results.size() - 4, 4, ".bin") == 0;
+        writer = make_unique<ResultWriter>(output.get(), binary ? ResultFormat::binary : ResultFormat::csv);
+        if (!binary)
+        {
+            fputs(ResultWriter::csv_header, output.get());
+        }
+    }
+
+    int quantum = quanta[0];
+    machine.cores = core_counts[0];
+    map<string, string> titles = {{"fifo", "FIFO"}, {"spn", "SPN"}, {"srt", "SRT"}, {"rr", "RR (q=" + to_string(quantum) + ")"}, {"hrrn", "HRRN"}, {"feedback", "Feedback (q=" + to_string(quantum) + "*2^i)"}};
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (i > 0)
+        {
+            cout << endl;
+        }
+        cout << titles[names[i]] << " scheduling:" << endl;
+
+        // Each run reads the workload afresh
+        unique_ptr<Workload> source;
+        if (traces[0] == "builtin")
+        {
+            source = make_unique<ArrayWorkload>(processes, sizeof(processes) / sizeof(processes[0]));
+        }
+        else
+        {
+            source = open_trace(traces[0]);
+        }
+        string name = names[i];
+        int policy = find(policy_names.begin(), policy_names.end(), name) - policy_names.begin();
+
+        if (workers > 0)
+        {
+            // Simulate the workload on as many cores as there are workers,
+            // then run it and compare
+            auto records = load_workload(*source);
+            if (!records)
+            {
+                cerr << "Error: " << source->error << endl;
+                return 1;
+            }
+            Machine config = machine;
+            config.cores = workers;
+            config.dispatch = Dispatch::global;
+            Metrics predicted, observed;
+            SharedWorkload replay(records);
+            simulate(replay, [&]()
+                     { return make_policy(name, quantum); }, config, [&](const Process &p)
+                     { predicted.record(p); });
+            execute_workload(*records, make_policy(name, quantum), workers, chrono::microseconds(tick), [&](const Process &p)
+                             {
+                                 observed.record(p);
+                                 if (writer)
+                                 {
+                                     writer->write(p, policy);
+                                 }
+                             });
+            if (writer)
+            {
+                writer->flush();
+            }
+            cout << "predicted on " << workers << " cores:" << endl;
+            print_metrics(predicted);
+            cout << "observed on " << workers << " workers:" << endl;
+            print_metrics(observed);
+            continue;
+        }
+
+        Metrics metrics;
+        MachineStats stats = simulate(*source, [&]()
+                                      { return make_policy(name, quantum); }, machine, [&](const Process &p)
+                                      {
+                                          metrics.record(p);
+                                          if (writer)
+                                          {
+                                              writer->write(p, policy);
+                                          }
+                                      });
+        if (writer)
+        {
+            writer->flush();
+        }
+        if (!source->error.empty())
+        {
+            cerr << "Error: " << source->error << endl;
+            return 1;
+        }
+        print_metrics(metrics);
+        if (machine.cores > 1)
+        {
+            print_machine(stats);
+        }
+    }
+    if (writer && writer->failed)
+    {
+        cerr << "Error: could not write the results" << endl;
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
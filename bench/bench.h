@@ -0,0 +1,138 @@
+// Shared harness for the benchmark programs in this directory. Each program
+// includes one module's source with its main renamed and times that module's
+// hot paths. Build and run one with, for example:
+//
+//   g++ -std=c++17 -O2 -pthread bench/fs_bench.cpp -o fs_bench
+//   ./fs_bench [--repetitions n] [--warmup n] [--filter text] [--format csv|json]
+//
+// Every benchmark runs its body warmup times untimed, then repetitions times
+// timed, and prints one line with the nanoseconds per operation: the minimum,
+// median, mean, maximum and standard deviation over the repetitions. Lines
+// are CSV with a header, or one JSON object each, so runs can be compared
+// by a script. Results go to stdout through stdio, so a module that prints
+// to std::cout can be silenced without losing them.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Options shared by every benchmark program
+struct BenchOptions
+{
+    int repetitions = 10;
+    int warmup = 2;
+    std::string filter; // run only benchmarks whose module/name contains this
+    bool json = false;
+    bool header_printed = false;
+};
+
+// Function to read the shared options, exiting with a usage message on an
+// unknown one
+BenchOptions parse_bench_options(int argc, char *argv[])
+{
+    BenchOptions options;
+    bool valid = argc % 2 == 1;
+    for (int i = 1; valid && i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i], value = argv[i + 1];
+        if (option == "--repetitions")
+        {
+            options.repetitions = std::atoi(value.c_str());
+            valid = options.repetitions > 0;
+        }
+        else if (option == "--warmup")
+        {
+            options.warmup = std::atoi(value.c_str());
+            valid = options.warmup >= 0;
+        }
+        else if (option == "--filter")
+        {
+            options.filter = value;
+        }
+        else if (option == "--format" && (value == "csv" || value == "json"))
+        {
+            options.json = value == "json";
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (!valid)
+    {
+        std::fprintf(stderr, "Usage: %s [--repetitions n] [--warmup n] [--filter text] [--format csv|json]\n", argv[0]);
+        std::exit(1);
+    }
+    return options;
+}
+
+// Function to time a benchmark. body performs ops operations; prepare, if
+// given, runs untimed before each call of body to set up fresh state.
+void run_benchmark(BenchOptions &options, const char *module, const char *name, std::uint64_t ops,
+                   const std::function<void()> &body, const std::function<void()> &prepare = nullptr)
+{
+    std::string full_name = std::string(module) + "/" + name;
+    if (full_name.find(options.filter) == std::string::npos)
+    {
+        return;
+    }
+
+    std::vector<double> samples; // nanoseconds per operation
+    for (int run = 0; run < options.warmup + options.repetitions; run++)
+    {
+        if (prepare)
+        {
+            prepare();
+        }
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if (run >= options.warmup)
+        {
+            samples.push_back(elapsed.count() / ops);
+        }
+    }
+
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    std::size_t n = sorted.size();
+    double median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    double mean = 0, variance = 0;
+    for (double sample : samples)
+    {
+        mean += sample / n;
+    }
+    for (double sample : samples)
+    {
+        variance += (sample - mean) * (sample - mean) / n;
+    }
+
+    if (options.json)
+    {
+        std::printf("{\"module\": \"%s\", \"benchmark\": \"%s\", \"ops\": %llu, \"repetitions\": %zu, "
+                    "\"min_ns\": %.3f, \"median_ns\": %.3f, \"mean_ns\": %.3f, \"max_ns\": %.3f, \"stddev_ns\": %.3f}\n",
+                    module, name, (unsigned long long)ops, n, sorted[0], median, mean, sorted[n - 1], std::sqrt(variance));
+    }
+    else
+    {
+        if (!options.header_printed)
+        {
+            std::printf("module,benchmark,ops,repetitions,min_ns,median_ns,mean_ns,max_ns,stddev_ns\n");
+            options.header_printed = true;
+        }
+        std::printf("%s,%s,%llu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f\n", module, name, (unsigned long long)ops, n, sorted[0],
+                    median, mean, sorted[n - 1], std::sqrt(variance));
+    }
+    std::fflush(stdout);
+}
+
+// Sink for results, so the compiler cannot drop the work that computes them
+volatile std::uint64_t bench_sink;
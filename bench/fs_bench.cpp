@@ -0,0 +1,99 @@
+// Benchmarks for FS.cpp: path lookup, directory creation and cd
+#define main fs_main
+#include "../FS.cpp"
+#undef main
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = parse_bench_options(argc, argv);
+    const int directories = 100;       // top-level directories
+    const int entries_per_directory = 100;
+    const std::uint64_t lookups = 200000;
+
+    // A tree of /b<i>/d<j> directories holding a file each, and one wide
+    // directory of files
+    format();
+    std::ostream discard(nullptr);
+    Session session = new_session(discard);
+    for (int i = 0; i < directories; i++)
+    {
+        std::string top = "/b" + std::to_string(i);
+        mkdir(session, top);
+        for (int j = 0; j < entries_per_directory; j++)
+        {
+            mkdir(session, top + "/d" + std::to_string(j));
+            write(session, top + "/d" + std::to_string(j) + "/f", "bench");
+        }
+    }
+    const int wide_entries = 100000;
+    mkdir(session, "/wide");
+    for (int i = 0; i < wide_entries; i++)
+    {
+        touch(session, "/wide/f" + std::to_string(i));
+    }
+
+    // The same pseudo-random paths for every run
+    std::mt19937 rng(1);
+    std::vector<std::string> paths(lookups), names(lookups);
+    for (std::uint64_t i = 0; i < lookups; i++)
+    {
+        paths[i] = "/b" + std::to_string(rng() % directories) + "/d" + std::to_string(rng() % entries_per_directory);
+        names[i] = "f" + std::to_string(rng() % wide_entries);
+    }
+
+    run_benchmark(options, "fs", "resolve_path", lookups, [&]()
+                  {
+        DirectoryRef dir;
+        Attributes attributes;
+        for (const std::string &path : paths)
+        {
+            bench_sink = bench_sink + static_cast<int>(resolve(session, path, dir, attributes));
+        } });
+
+    DirectoryRef wide;
+    Attributes wide_attributes;
+    resolve(session, "/wide", wide, wide_attributes);
+    run_benchmark(options, "fs", "lookup_wide_directory", lookups, [&]()
+                  {
+        DirectoryRef target;
+        Attributes attributes;
+        for (const std::string &name : names)
+        {
+            bench_sink = bench_sink + static_cast<int>(lookup(wide, name, target, attributes));
+        } });
+
+    run_benchmark(options, "fs", "stat_file", lookups, [&]()
+                  {
+        for (const std::string &path : paths)
+        {
+            bench_sink = bench_sink + static_cast<int>(stat(session, path + "/f"));
+        } });
+
+    run_benchmark(options, "fs", "cd", lookups, [&]()
+                  {
+        for (const std::string &path : paths)
+        {
+            bench_sink = bench_sink + static_cast<int>(cd(session, path));
+        } });
+    cd(session, "/");
+
+    // Each run creates its directories under a fresh parent
+    const std::uint64_t creates = 50000;
+    int run = 0;
+    std::string parent;
+    run_benchmark(
+        options, "fs", "mkdir", creates, [&]()
+        {
+            for (std::uint64_t i = 0; i < creates; i++)
+            {
+                bench_sink = bench_sink + static_cast<int>(mkdir(session, parent + "/m" + std::to_string(i)));
+            } },
+        [&]()
+        {
+            parent = "/mkdir" + std::to_string(run++);
+            mkdir(session, parent);
+        });
+    return 0;
+}
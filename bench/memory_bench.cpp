@@ -0,0 +1,235 @@
+// Benchmarks for MemoryManagement.cpp: the allocate, age and release cycle
+// the simulation runs for every request, for each allocator it tries, and
+// the page replacement policies over a generated reference trace, with and
+// without address translation, and the arena allocator against malloc on
+// several threads
+#define main memory_main
+#include "../MemoryManagement.cpp"
+#undef main
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "bench.h"
+
+// Function to run ops allocations and frees over threads: each thread
+// either frees and reallocates the blocks of its own window (local), or
+// frees the blocks its neighbour allocated in the last round (handoff)
+template <typename Allocate, typename Free>
+void churn(int threads, std::uint64_t ops, bool handoff, const std::vector<std::size_t> &sizes, Allocate allocate, Free release)
+{
+    const std::size_t window = 256;
+    std::vector<std::vector<void *>> blocks(threads, std::vector<void *>(window));
+    std::uint64_t rounds = ops / threads / window / 2;
+    std::atomic<std::uint64_t> arrived{0};
+    auto work = [&](int thread)
+    {
+        std::size_t next = thread * 7919;
+        for (std::uint64_t round = 0; round < rounds; round++)
+        {
+            for (void *&block : blocks[thread])
+            {
+                block = allocate(sizes[next++ % sizes.size()]);
+            }
+            if (handoff)
+            {
+                // Wait for every thread to allocate its round, free the
+                // neighbour's, then wait again before reusing the window
+                arrived++;
+                while (arrived < (2 * round + 1) * threads)
+                {
+                    std::this_thread::yield();
+                }
+                for (void *block : blocks[(thread + 1) % threads])
+                {
+                    release(block);
+                }
+                arrived++;
+                while (arrived < (2 * round + 2) * threads)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            else
+            {
+                for (void *block : blocks[thread])
+                {
+                    release(block);
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int thread = 0; thread < threads; thread++)
+    {
+        workers.emplace_back(work, thread);
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = parse_bench_options(argc, argv);
+    const int count = 20000;
+
+    // The same request stream for every run, drawn like the simulation's
+    std::mt19937 rng(1);
+    std::vector<Request> requests;
+    for (int i = 0; i < count; i++)
+    {
+        int size = rng() % (MAX_REQUEST_SIZE - MIN_REQUEST_SIZE + 1) + MIN_REQUEST_SIZE;
+        int persistence = rng() % 10 + 1;
+        requests.push_back({i, size, persistence});
+    }
+
+    for (int pageSize : {128, 256, 512, 1024})
+    {
+        std::unique_ptr<MemoryManager> manager;
+        auto fresh = [&]()
+        {
+            manager = std::make_unique<MemoryManager>(pageSize);
+        };
+
+        std::string name = "allocate_release_cycle_" + std::to_string(pageSize);
+        run_benchmark(
+            options, "memory", name.c_str(), count, [&]()
+            {
+                for (const Request &request : requests)
+                {
+                    bench_sink = bench_sink + manager->allocateMemory(request);
+                    manager->decrementPersistence();
+                    manager->releaseMemory();
+                } },
+            fresh);
+
+        // Allocation alone, into memory that fills up and starts refusing
+        name = "allocate_" + std::to_string(pageSize);
+        run_benchmark(
+            options, "memory", name.c_str(), count, [&]()
+            {
+                for (const Request &request : requests)
+                {
+                    bench_sink = bench_sink + manager->allocateMemory(request);
+                } },
+            fresh);
+    }
+
+    const std::pair<const char *, std::function<std::unique_ptr<Allocator>()>> backends[] = {
+        {"buddy", []()
+         { return std::make_unique<BuddyAllocator>(MEMORY_SIZE); }},
+        {"slab", []()
+         { return std::make_unique<SlabAllocator>(MEMORY_SIZE); }},
+        {"first_fit", []()
+         { return std::make_unique<SegregatedFitAllocator>(MEMORY_SIZE, false); }},
+        {"best_fit", []()
+         { return std::make_unique<SegregatedFitAllocator>(MEMORY_SIZE, true); }},
+    };
+    for (const auto &backend : backends)
+    {
+        std::unique_ptr<MemoryManager> manager;
+        std::string name = std::string("allocate_release_cycle_") + backend.first;
+        run_benchmark(
+            options, "memory", name.c_str(), count, [&]()
+            {
+                for (const Request &request : requests)
+                {
+                    bench_sink = bench_sink + manager->allocateMemory(request);
+                    manager->decrementPersistence();
+                    manager->releaseMemory();
+                } },
+            [&]()
+            { manager = std::make_unique<MemoryManager>(backend.second()); });
+    }
+
+    // A large memory of small pages, where scanning every page would
+    // dominate
+    const long long large_memory = 4LL << 30;
+    std::unique_ptr<MemoryManager> manager;
+    run_benchmark(
+        options, "memory", "allocate_release_cycle_1024_in_4gb", count, [&]()
+        {
+            for (const Request &request : requests)
+            {
+                bench_sink = bench_sink + manager->allocateMemory(request);
+                manager->decrementPersistence();
+                manager->releaseMemory();
+            } },
+        [&]()
+        { manager = std::make_unique<MemoryManager>(1024, large_memory); });
+
+    // One reference per operation, replayed from memory so generation is
+    // not timed
+    const int references = 200000;
+    std::vector<Reference> trace;
+    GeneratedReferences generated(LocalityModel::workingSet, references, 8, 1024, 1);
+    Reference reference;
+    while (generated.next(reference))
+    {
+        trace.push_back(reference);
+    }
+    const std::pair<const char *, std::function<std::unique_ptr<ReplacementPolicy>()>> policies[] = {
+        {"fifo", []()
+         { return std::make_unique<FifoPolicy>(100); }},
+        {"lru", []()
+         { return std::make_unique<LruPolicy>(100); }},
+        {"clock", []()
+         { return std::make_unique<ClockPolicy>(100); }},
+        {"arc", []()
+         { return std::make_unique<ArcPolicy>(100); }},
+    };
+    for (const auto &policy : policies)
+    {
+        std::string name = std::string("paging_") + policy.first;
+        run_benchmark(options, "memory", name.c_str(), references, [&]()
+                      {
+                          ReplayReferences replay(trace);
+                          std::unique_ptr<ReplacementPolicy> replacement = policy.second();
+                          bench_sink = bench_sink + simulatePaging(replay, *replacement, 100, 1024).faults;
+                      });
+    }
+
+    // LRU again with every reference translated through the TLB and four
+    // levels of page tables
+    run_benchmark(options, "memory", "paging_lru_translated", references, [&]()
+                  {
+                      ReplayReferences replay(trace);
+                      LruPolicy replacement(100);
+                      Mmu mmu(TranslationOptions(), 1024);
+                      bench_sink = bench_sink + simulatePaging(replay, replacement, 100, 1024, &mmu).faults;
+                  });
+
+    // One operation is an allocation or a free; sizes are mostly small
+    std::vector<std::size_t> sizes;
+    for (int i = 0; i < 4096; i++)
+    {
+        int kind = rng() % 100;
+        sizes.push_back(kind < 90 ? 16 + rng() % 497 : kind < 99 ? 512 + rng() % 7681 : 8192 + rng() % 57345);
+    }
+    const std::uint64_t churn_ops = 1 << 20;
+    ArenaAllocator arena(std::size_t(1) << 30);
+    for (int threads : {1, 4, 8})
+    {
+        for (bool handoff : {false, true})
+        {
+            std::string pattern = std::string(handoff ? "handoff_" : "local_") + std::to_string(threads) + "_threads";
+            std::string name = "arena_" + pattern;
+            run_benchmark(options, "memory", name.c_str(), churn_ops, [&]()
+                          { churn(threads, churn_ops, handoff, sizes, [&](std::size_t size)
+                                  { return arena.allocate(size); },
+                                  [&](void *pointer)
+                                  { arena.free(pointer); }); });
+            name = "malloc_" + pattern;
+            run_benchmark(options, "memory", name.c_str(), churn_ops, [&]()
+                          { churn(threads, churn_ops, handoff, sizes, [](std::size_t size)
+                                  { return std::malloc(size); },
+                                  [](void *pointer)
+                                  { std::free(pointer); }); });
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+// Benchmarks for PC.cpp: handing items through the shared circular queue
+// with produce_item and consume_item
+#define main pc_main
+#include "../PC.cpp"
+#undef main
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = parse_bench_options(argc, argv);
+    const int count = 200000;
+
+    // The queue functions report waiting on std::cout; keep that out of
+    // the results, which go to stdout through stdio
+    std::cout.setstate(std::ios::badbit);
+
+    // One thread alternating, so no call ever waits
+    run_benchmark(options, "pc", "produce_consume_same_thread", count, []()
+                  {
+        for (int i = 0; i < count; i++)
+        {
+            produce_item(i);
+            bench_sink = bench_sink + consume_item();
+        } });
+
+    // A producer thread and a consumer thread, waking each other whenever
+    // the queue fills or empties
+    run_benchmark(options, "pc", "handoff_two_threads", count, []()
+                  {
+        std::thread producer([]()
+                             {
+            for (int i = 0; i < count; i++)
+            {
+                produce_item(i);
+            } });
+        for (int i = 0; i < count; i++)
+        {
+            bench_sink = bench_sink + consume_item();
+        }
+        producer.join(); });
+
+    // Several producers and consumers, as in the program
+    const int pairs = 4;
+    run_benchmark(options, "pc", "handoff_4_producers_4_consumers", count, []()
+                  {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < pairs; t++)
+        {
+            threads.emplace_back([]()
+                                 {
+                for (int i = 0; i < count / pairs; i++)
+                {
+                    produce_item(i);
+                } });
+            threads.emplace_back([]()
+                                 {
+                for (int i = 0; i < count / pairs; i++)
+                {
+                    bench_sink = bench_sink + consume_item();
+                } });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+    });
+    return 0;
+}
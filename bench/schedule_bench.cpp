@@ -0,0 +1,65 @@
+// Benchmarks for Schedule.cpp: the simulator's cost per process under each
+// policy, on one core and on several
+#define main schedule_main
+#include "../Schedule.cpp"
+#undef main
+
+#include <random>
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = parse_bench_options(argc, argv);
+    const int count = 200000;
+
+    // A workload that keeps the ready queue busy: arrivals about as fast as
+    // one core can serve them, with bursts from 1 to 20
+    mt19937 rng(1);
+    auto records = make_shared<vector<Process>>();
+    int arrival = 0;
+    for (int i = 0; i < count; i++)
+    {
+        arrival += rng() % 21;
+        int burst = 1 + rng() % 20;
+        records->push_back({arrival, burst, 0, 0, 0, 0, i, 0, 0});
+    }
+
+    struct Config
+    {
+        const char *name;
+        Dispatch dispatch;
+        int cores;
+    };
+    const Config configs[] = {{"", Dispatch::global, 1}, {"_4_cores_global", Dispatch::global, 4}, {"_4_cores_steal", Dispatch::steal, 4}};
+    for (const Config &config : configs)
+    {
+        for (const string &name : policy_names)
+        {
+            Machine machine;
+            machine.cores = config.cores;
+            machine.dispatch = config.dispatch;
+            string benchmark = "dispatch_" + name + config.name;
+            run_benchmark(options, "schedule", benchmark.c_str(), count, [&]()
+                          {
+                SharedWorkload source(records);
+                simulate(source, [&]()
+                         { return make_policy(name, 4); }, machine, [](const Process &p)
+                         { bench_sink = bench_sink + p.finish_time; }); });
+        }
+    }
+
+    // Formatting per-process results into the buffered writer
+    FILE *null_file = fopen("/dev/null", "wb");
+    run_benchmark(options, "schedule", "write_results_text", count, [&]()
+                  {
+        ResultWriter writer(null_file, ResultFormat::text);
+        for (const Process &p : *records)
+        {
+            Process finished = p;
+            finished.start_time = finished.finish_time = p.arrival_time + p.burst_time;
+            writer.write(finished, 0);
+        } });
+    fclose(null_file);
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Benchmarks for test.cpp: the mutex-protected counter in sharedData and
+// signalling through its condition variable
+#define main test_main
+#include "../test.cpp"
+#undef main
+
+#include <vector>
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = parse_bench_options(argc, argv);
+    const int count = 1000000;
+    sharedData data;
+    data.count = 0;
+
+    run_benchmark(options, "test", "counter_uncontended", count, [&]()
+                  {
+        for (int i = 0; i < count; i++)
+        {
+            unique_lock<mutex> lck(data.m);
+            data.count++;
+        } });
+
+    // NumThreads threads sharing the count
+    run_benchmark(options, "test", "counter_contended", count, [&]()
+                  {
+        std::vector<thread> threads;
+        for (int t = 0; t < NumThreads; t++)
+        {
+            threads.emplace_back([&]()
+                                 {
+                for (int i = 0; i < count / NumThreads; i++)
+                {
+                    unique_lock<mutex> lck(data.m);
+                    data.count++;
+                } });
+        }
+        for (thread &t : threads)
+        {
+            t.join();
+        }
+    });
+
+    // Two threads taking turns: each waits on the condition variable for
+    // the count's parity to be its own, bumps it and notifies the other
+    const int turns = 100000;
+    run_benchmark(options, "test", "condvar_ping_pong", turns, [&]()
+                  {
+        data.count = 0;
+        auto player = [&](int parity)
+        {
+            for (int i = 0; i < turns / 2; i++)
+            {
+                unique_lock<mutex> lck(data.m);
+                data.cv.wait(lck, [&]()
+                             { return data.count % 2 == parity; });
+                data.count++;
+                data.cv.notify_one();
+            }
+        };
+        thread other(player, 1);
+        player(0);
+        other.join(); });
+    bench_sink = bench_sink + data.count;
+    return 0;
+}